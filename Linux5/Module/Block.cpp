@@ -23,9 +23,20 @@
 #include "Uring.h"
 #include <vector>
 #include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
 #include <filesystem>
+#include <linux/fs.h>
+#include <linux/falloc.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
 #include "kls/io/Block.h"
 
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+
 namespace {
     using namespace kls;
     using namespace kls::io;
@@ -46,9 +57,47 @@ namespace {
         if (flags & Block::Flag::F_CREAT) result |= O_CREAT;
         if (flags & Block::Flag::F_EXCL) result |= O_EXCL;
         if (flags & Block::Flag::F_TRUNC) result |= O_TRUNC;
+        if (flags & Block::Flag::F_DIRECT) result |= O_DIRECT;
+        if (flags & Block::Flag::F_DSYNC) result |= O_DSYNC;
+        if (flags & Block::Flag::F_NOATIME) result |= O_NOATIME;
         return result;
     }
 
+    int allocation_conv(uint32_t mode) noexcept {
+        int result = 0;
+        if (mode & Block::A_KEEP_SIZE) result |= FALLOC_FL_KEEP_SIZE;
+        if (mode & Block::A_PUNCH_HOLE) result |= FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+        if (mode & Block::A_ZERO_RANGE) result |= FALLOC_FL_ZERO_RANGE;
+        return result;
+    }
+
+    int advice_conv(Block::Advice advice) noexcept {
+        switch (advice) {
+            case Block::ADVICE_SEQUENTIAL: return POSIX_FADV_SEQUENTIAL;
+            case Block::ADVICE_RANDOM: return POSIX_FADV_RANDOM;
+            case Block::ADVICE_WILLNEED: return POSIX_FADV_WILLNEED;
+            case Block::ADVICE_DONTNEED: return POSIX_FADV_DONTNEED;
+            case Block::ADVICE_NOREUSE: return POSIX_FADV_NOREUSE;
+            default: return POSIX_FADV_NORMAL;
+        }
+    }
+
+    // The alignment direct I/O on `fd` requires, which is the logical block size of the device
+    uint32_t direct_alignment(int fd) noexcept {
+        struct statx info{};
+#ifdef STATX_DIOALIGN
+        if (statx(fd, "", AT_EMPTY_PATH, STATX_TYPE | STATX_DIOALIGN, &info) != 0) return 4096;
+        if ((info.stx_mask & STATX_DIOALIGN) && info.stx_dio_offset_align)
+            return std::max(info.stx_dio_mem_align, info.stx_dio_offset_align);
+#else
+        if (statx(fd, "", AT_EMPTY_PATH, STATX_TYPE, &info) != 0) return 4096;
+#endif
+        if (int size{}; S_ISBLK(info.stx_mode) && ioctl(fd, BLKSSZGET, &size) == 0 && size > 0)
+            return static_cast<uint32_t>(size);
+        // no way to tell for files on kernels before 6.1, no device has blocks larger than a page
+        return 4096;
+    }
+
     IOAwait<IOResult> open_impl(Uring &core, const char *path, uint32_t flags, mode_t mode) {
         return io_plain<IOResult, IoOps::Open>(0, path, static_cast<int>(flags), mode);
     }
@@ -58,32 +107,271 @@ namespace kls::io {
     coroutine::ValueAsync<SafeHandle<Block>> Block::open(std::string_view path, uint32_t flags) {
         auto core = Uring::get();
         const auto absolute = std::filesystem::absolute({path}).generic_string();
-        if (const auto res = co_await open_impl(*core, absolute.c_str(), flag_conv(flags), 00600); res.success())
-            co_return SafeHandle{Block{res.result()}};
+        if (const auto res = co_await open_impl(*core, absolute.c_str(), flag_conv(flags), 00600); res.success()) {
+            Block block{res.result()};
+            if (flags & F_DIRECT) block.m_align = direct_alignment(res.result());
+            co_return SafeHandle{std::move(block)};
+        }
         else
             throw exception_errc(res.error());
     }
 
+    AlignedBuffer Block::aligned_buffer(size_t size) const { return AlignedBuffer{size, std::max(m_align, 64u)}; }
+
     Block::Block(int h) : Handle<int>([c = Uring::get()](int h) noexcept {}, h) {}
 
+    static FileRef file(const int fd, const int slot) noexcept {
+        return slot < 0 ? FileRef{fd, false} : FileRef{slot, true};
+    }
+
     template<IoOps Op>
-    static IOAwait<IOResult> simple(const int fd, Span<> span, uint64_t offset) noexcept {
+    static IOAwait<IOResult> simple(const FileRef fd, Span<> span, uint64_t offset) noexcept {
         return io_plain<IOResult, Op>(fd, span.data(), span.size(), offset);
     }
 
     IOAwait<IOResult> Block::read(Span<> span, uint64_t offset) noexcept {
-        return simple<IoOps::Read>(value(), span, offset);
+        if (!aligned(span.data(), span.size(), offset)) return io_immediate<IOResult>(-EINVAL);
+        return simple<IoOps::Read>(file(value(), m_slot), span, offset);
     }
 
     IOAwait<IOResult> Block::write(Span<> span, uint64_t offset) noexcept {
-        return simple<IoOps::Write>(value(), span, offset);
+        if (!aligned(span.data(), span.size(), offset)) return io_immediate<IOResult>(-EINVAL);
+        return simple<IoOps::Write>(file(value(), m_slot), span, offset);
+    }
+
+    template<IoOps Op>
+    static IOAwait<IOResult> fixed(const FileRef fd, FixedBuffer buffer, uint64_t offset) noexcept {
+        const auto span = buffer.span;
+        return io_plain<IOResult, Op>(fd, span.data(), span.size(), offset, int(buffer.index));
+    }
+
+    IOAwait<IOResult> Block::read_fixed(FixedBuffer buffer, uint64_t offset) noexcept {
+        if (!aligned(buffer.span.data(), buffer.span.size(), offset)) return io_immediate<IOResult>(-EINVAL);
+        return fixed<IoOps::ReadFixed>(file(value(), m_slot), buffer, offset);
+    }
+
+    IOAwait<IOResult> Block::write_fixed(FixedBuffer buffer, uint64_t offset) noexcept {
+        if (!aligned(buffer.span.data(), buffer.span.size(), offset)) return io_immediate<IOResult>(-EINVAL);
+        return fixed<IoOps::WriteFixed>(file(value(), m_slot), buffer, offset);
+    }
+
+    template<IoOps Op>
+    static IOAwait<IOResult> vectored(const FileRef fd, Span<IoVec> vec, uint64_t offset) noexcept {
+        const auto iov = reinterpret_span_cast<iovec>(vec);
+        return io_plain<IOResult, Op>(fd, iov.data(), static_cast<unsigned>(iov.size()), offset);
+    }
+
+    bool Block::aligned(Span<IoVec> vec, uint64_t offset) const noexcept {
+        if (!aligned(nullptr, 0, offset)) return false;
+        for (const auto &v: reinterpret_span_cast<iovec>(vec)) if (!aligned(v.iov_base, v.iov_len, 0)) return false;
+        return true;
+    }
+
+    IOAwait<IOResult> Block::readv(Span<IoVec> vec, uint64_t offset) noexcept {
+        if (!aligned(vec, offset)) return io_immediate<IOResult>(-EINVAL);
+        return vectored<IoOps::ReadV>(file(value(), m_slot), vec, offset);
+    }
+
+    IOAwait<IOResult> Block::writev(Span<IoVec> vec, uint64_t offset) noexcept {
+        if (!aligned(vec, offset)) return io_immediate<IOResult>(-EINVAL);
+        return vectored<IoOps::WriteV>(file(value(), m_slot), vec, offset);
+    }
+
+    BatchAwait Block::read_batch(Span<ReadRequest> requests) {
+        const auto fd = file(value(), m_slot);
+        return BatchAwait{
+                requests, [&](ChainLink *links) noexcept {
+                    // refused before anything is submitted, the completion count is not shared with the kernel yet.
+                    // The kernel takes 32 bit lengths, larger buffers are refused rather than cut short
+                    for (size_t i = 0; i < requests.size(); ++i) {
+                        const auto &request = requests.data()[i];
+                        const auto size = request.buffer.size();
+                        if (size <= UINT32_MAX && aligned(request.buffer.data(), size, request.offset)) continue;
+                        links[i].result = -EINVAL;
+                        IoRing::finish(links[i].await, -EINVAL);
+                    }
+                    const auto ring = IoRing::get();
+                    std::lock_guard lk{ring->lock()};
+                    for (size_t i = 0; i < requests.size(); ++i) {
+                        const auto &request = requests.data()[i];
+                        if (links[i].result == -EINVAL) continue;
+                        const auto sqe = ring->get_sqe();
+                        io_pack_args<IoOps::Read>(sqe, fd, request.buffer.data(), request.buffer.size(), request.offset);
+                        io_uring_sqe_set_data(sqe, tag(&links[i]));
+                    }
+                    if (requests.size()) ring->adopt(links[0].await);
+                    ring->submit();
+                }
+        };
     }
 
     IOAwait<Status> Block::sync() noexcept {
-        return io_plain<Status, IoOps::Sync>(value(), IORING_FSYNC_DATASYNC);
+        return io_plain<Status, IoOps::Sync>(file(value(), m_slot), IORING_FSYNC_DATASYNC);
+    }
+
+    IOAwait<Status> Block::allocate(uint64_t offset, uint64_t length, uint32_t mode) noexcept {
+        return io_plain<Status, IoOps::Fallocate>(file(value(), m_slot), allocation_conv(mode), offset, length);
+    }
+
+    IOAwait<Status> Block::advise(uint64_t offset, uint64_t length, Advice advice) noexcept {
+        // the length is 32 bits wide in the submission entry, and 0 stands for the end of the file
+        const auto count = length > UINT32_MAX ? off_t(0) : static_cast<off_t>(length);
+        return io_plain<Status, IoOps::Fadvise>(file(value(), m_slot), offset, count, advice_conv(advice));
+    }
+
+    IOAwait<Status> Block::truncate(uint64_t length) noexcept {
+        // IORING_OP_FTRUNCATE needs Linux 6.9, a size change is a quick metadata update anyway
+        return io_immediate<Status>(ftruncate(value(), static_cast<off_t>(length)) == 0 ? 0 : -errno);
+    }
+
+    IOAwait<Status> Block::sync_all() noexcept {
+        return io_plain<Status, IoOps::Sync>(file(value(), m_slot), 0u);
+    }
+
+    IOAwait<Status> Block::sync_range(uint64_t offset, uint64_t length, uint32_t flags) noexcept {
+        int mode = 0;
+        if (flags & SR_WAIT_BEFORE) mode |= SYNC_FILE_RANGE_WAIT_BEFORE;
+        if (flags & SR_WRITE) mode |= SYNC_FILE_RANGE_WRITE;
+        if (flags & SR_WAIT_AFTER) mode |= SYNC_FILE_RANGE_WAIT_AFTER;
+        // the length is 32 bits wide in the submission entry, and 0 stands for the end of the file
+        const auto count = length > UINT32_MAX ? 0u : static_cast<unsigned>(length);
+        return io_plain<Status, IoOps::SyncRange>(file(value(), m_slot), count, offset, mode);
+    }
+
+    static LinkedOp describe(LinkedOp::Kind kind, const FileRef fd, Span<> span, uint64_t offset, uint16_t buffer = 0) noexcept {
+        return LinkedOp{
+                .kind = kind, .fd = fd.fd, .fixed_file = fd.fixed, .buffer = buffer,
+                .data = span.data(), .size = span.size(), .offset = offset
+        };
+    }
+
+    static LinkedOp refused() noexcept { return LinkedOp{.kind = LinkedOp::Refused}; }
+
+    LinkedOp Block::read_op(Span<> span, uint64_t offset) noexcept {
+        if (!aligned(span.data(), span.size(), offset)) return refused();
+        return describe(LinkedOp::Read, file(value(), m_slot), span, offset);
+    }
+
+    LinkedOp Block::write_op(Span<> span, uint64_t offset) noexcept {
+        if (!aligned(span.data(), span.size(), offset)) return refused();
+        return describe(LinkedOp::Write, file(value(), m_slot), span, offset);
+    }
+
+    static LinkedOp describe(LinkedOp::Kind kind, const FileRef fd, Span<IoVec> vec, uint64_t offset) noexcept {
+        return LinkedOp{
+                .kind = kind, .fd = fd.fd, .fixed_file = fd.fixed, .buffer = 0,
+                .data = vec.data(), .size = vec.size(), .offset = offset
+        };
+    }
+
+    LinkedOp Block::readv_op(Span<IoVec> vec, uint64_t offset) noexcept {
+        if (!aligned(vec, offset)) return refused();
+        return describe(LinkedOp::ReadV, file(value(), m_slot), vec, offset);
+    }
+
+    LinkedOp Block::writev_op(Span<IoVec> vec, uint64_t offset) noexcept {
+        if (!aligned(vec, offset)) return refused();
+        return describe(LinkedOp::WriteV, file(value(), m_slot), vec, offset);
+    }
+
+    LinkedOp Block::read_fixed_op(FixedBuffer buffer, uint64_t offset) noexcept {
+        if (!aligned(buffer.span.data(), buffer.span.size(), offset)) return refused();
+        return describe(LinkedOp::ReadFixed, file(value(), m_slot), buffer.span, offset, buffer.index);
+    }
+
+    LinkedOp Block::write_fixed_op(FixedBuffer buffer, uint64_t offset) noexcept {
+        if (!aligned(buffer.span.data(), buffer.span.size(), offset)) return refused();
+        return describe(LinkedOp::WriteFixed, file(value(), m_slot), buffer.span, offset, buffer.index);
     }
 
+    LinkedOp Block::sync_op() noexcept { return describe(LinkedOp::Sync, file(value(), m_slot), {}, 0); }
+
+    LinkedOp Block::sync_all_op() noexcept { return describe(LinkedOp::SyncAll, file(value(), m_slot), {}, 0); }
+
     IOAwait<Status> Block::close() noexcept {
+        if (m_slot >= 0) IoContext::get().unregister_file(std::exchange(m_slot, -1));
         return io_plain<Status, IoOps::Close>(value());
     }
+
+    MappedView Block::map(uint64_t offset, size_t length, uint32_t flags) {
+        if (!length) {
+            struct stat info{};
+            if (fstat(value(), &info) != 0) throw exception_errc(map_error(errno));
+            const auto size = static_cast<uint64_t>(info.st_size);
+            if (offset >= size) throw exception_errc(IO_EINVAL);
+            length = static_cast<size_t>(size - offset);
+        }
+        // mmap takes page aligned offsets only, so the view may start inside the first page of the mapping
+        const auto page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        const auto skip = offset % page;
+        const auto total = static_cast<size_t>(length + skip);
+        const auto populate = (flags & M_POPULATE) ? MAP_POPULATE : 0;
+        const auto base = mmap(nullptr, total, PROT_READ, MAP_SHARED | populate, value(), static_cast<off_t>(offset - skip));
+        if (base == MAP_FAILED) throw exception_errc(map_error(errno));
+        // advice only tunes paging, the view works the same without it
+        if (flags & M_HUGEPAGE) madvise(base, total, MADV_HUGEPAGE);
+        if (flags & M_SEQUENTIAL) madvise(base, total, MADV_SEQUENTIAL);
+        if (flags & M_RANDOM) madvise(base, total, MADV_RANDOM);
+        return MappedView{base, total, static_cast<std::byte *>(base) + skip, length};
+    }
+
+    coroutine::ValueAsync<Status> Block::copy_from(Block &source, uint64_t from, uint64_t to, uint64_t length) {
+        // there is no ring operation for copy_file_range, so it blocks the executor thread. Small steps
+        //     bound how long each call holds it up, and cost little more on reflinks that copy nothing
+        constexpr uint64_t step = 1u << 20;
+        while (length) {
+            auto in = static_cast<off64_t>(from), out = static_cast<off64_t>(to);
+            const auto copied = copy_file_range(source.value(), &in, value(), &out, std::min(length, step), 0);
+            if (copied < 0) {
+                const auto code = errno;
+                // across file systems before Linux 5.19, or on file systems without support for it
+                if (code == EXDEV || code == EINVAL || code == ENOSYS || code == EOPNOTSUPP)
+                    co_return co_await splice_through(source.value(), from, value(), static_cast<int64_t>(to), length);
+                co_return map_error(code);
+            }
+            if (!copied) co_return IO_EIO;
+            from += copied, to += copied, length -= copied;
+        }
+        co_return IO_OK;
+    }
+
+    MappedView::MappedView(MappedView &&other) noexcept:
+            m_base(std::exchange(other.m_base, nullptr)), m_length(other.m_length),
+            m_data(other.m_data), m_size(other.m_size) {}
+
+    MappedView &MappedView::operator=(MappedView &&other) noexcept {
+        if (this != &other) {
+            if (m_base) munmap(m_base, m_length);
+            m_base = std::exchange(other.m_base, nullptr);
+            m_length = other.m_length, m_data = other.m_data, m_size = other.m_size;
+        }
+        return *this;
+    }
+
+    MappedView::~MappedView() noexcept { if (m_base) munmap(m_base, m_length); }
+
+    coroutine::ValueAsync<Status> MappedView::prefault() const {
+        // an io_uring madvise runs on a kernel worker, so the faults are taken there instead of on this thread.
+        // The length is 32 bits wide in the submission entry, large views go in steps
+        constexpr size_t step = 1u << 30;
+        auto advice = MADV_POPULATE_READ;
+        for (size_t done = 0; done < m_length;) {
+            const auto at = static_cast<std::byte *>(m_base) + done;
+            const auto length = static_cast<off_t>(std::min(step, m_length - done));
+            const auto status = co_await io_plain<Status, IoOps::Madvise>(at, length, advice);
+            if (status == IO_EINVAL && advice == MADV_POPULATE_READ) {
+                advice = MADV_WILLNEED;
+                continue;
+            }
+            if (status != IO_OK) co_return status;
+            done += static_cast<size_t>(length);
+        }
+        co_return IO_OK;
+    }
+
+    Status Block::register_file() noexcept {
+        if (m_slot >= 0) return IO_OK;
+        if (const auto slot = IoContext::get().register_file(value()); slot >= 0) return (m_slot = slot, IO_OK);
+        else return map_error(-slot);
+    }
 }
@@ -0,0 +1,157 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include "Provided.h"
+#include <cstdlib>
+#include <unistd.h>
+
+namespace {
+    using namespace kls;
+    using namespace kls::io;
+    using namespace kls::io::detail;
+    using namespace kls::essential;
+
+    struct Free {
+        void operator()(std::byte *p) const noexcept { std::free(p); }
+    };
+
+    class FixedBufferPoolImpl : public FixedBufferPool {
+    public:
+        FixedBufferPoolImpl(size_t count, size_t size) : m_size(size), m_count(static_cast<unsigned>(count)) {
+            // page aligned so that the buffers are also usable for direct I/O
+            const auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            const auto total = (count * size + page - 1) / page * page;
+            m_memory.reset(static_cast<std::byte *>(std::aligned_alloc(page, total)));
+            if (!m_memory) throw exception_errc(IO_ENOMEM);
+            std::vector<iovec> buffers(count);
+            for (size_t i = 0; i < count; ++i) buffers[i] = iovec{m_memory.get() + i * size, size};
+            m_first = IoContext::get().register_buffers(Span<iovec>(buffers.data(), buffers.size()));
+            if (m_first < 0) throw exception_errc(IO_ENOBUFS);
+            m_free.reserve(count);
+            for (auto i = m_count; i > 0; --i) m_free.push_back(i - 1);
+        }
+
+        ~FixedBufferPoolImpl() override { IoContext::get().unregister_buffers(m_first, m_count); }
+
+        std::optional<FixedBuffer> acquire() noexcept override {
+            std::lock_guard lk{m_lock};
+            if (m_free.empty()) return std::nullopt;
+            const auto i = m_free.back();
+            m_free.pop_back();
+            return FixedBuffer{Span<>(m_memory.get() + i * m_size, m_size), static_cast<uint16_t>(m_first + i)};
+        }
+
+        void release(FixedBuffer buffer) noexcept override {
+            std::lock_guard lk{m_lock};
+            m_free.push_back(buffer.index - m_first);
+        }
+    private:
+        SafeHandle<Uring> m_core = Uring::get();
+        const size_t m_size;
+        const unsigned m_count;
+        int m_first{-1};
+        std::unique_ptr<std::byte[], Free> m_memory{};
+        thread::SpinLock m_lock{};
+        std::vector<unsigned> m_free{};
+    };
+}
+
+namespace kls::io::detail {
+    BufferRingImpl::BufferRingImpl(unsigned count, size_t size) :
+            m_count(count), m_size(size), m_group(IoContext::get().allocate_group()),
+            m_memory(std::make_unique_for_overwrite<std::byte[]>(count * size)) {
+        int ret{};
+        m_buffers = io_uring_setup_buf_ring(&m_ring->ring(), count, m_group, 0, &ret);
+        if (!m_buffers) throw exception_errc(map_error(-ret));
+        const auto mask = io_uring_buf_ring_mask(count);
+        for (unsigned i = 0; i < count; ++i) {
+            const auto id = static_cast<uint16_t>(i);
+            io_uring_buf_ring_add(m_buffers, buffer(id), m_size, id, mask, static_cast<int>(i));
+        }
+        io_uring_buf_ring_advance(m_buffers, static_cast<int>(count));
+    }
+
+    BufferRingImpl::~BufferRingImpl() noexcept { io_uring_free_buf_ring(&m_ring->ring(), m_buffers, m_count, m_group); }
+
+    void BufferRingImpl::recycle(uint16_t id) noexcept {
+        std::lock_guard lk{m_lock};
+        io_uring_buf_ring_add(m_buffers, buffer(id), m_size, id, io_uring_buf_ring_mask(m_count), 0);
+        io_uring_buf_ring_advance(m_buffers, 1);
+    }
+}
+
+namespace kls::io {
+    BufferRing::Lease::Lease(Lease &&other) noexcept:
+            m_ring(std::exchange(other.m_ring, nullptr)), m_data(other.m_data), m_size(other.m_size), m_id(other.m_id) {}
+
+    BufferRing::Lease &BufferRing::Lease::operator=(Lease &&other) noexcept {
+        if (this != &other) {
+            reset();
+            m_ring = std::exchange(other.m_ring, nullptr);
+            m_data = other.m_data, m_size = other.m_size, m_id = other.m_id;
+        }
+        return *this;
+    }
+
+    void BufferRing::Lease::reset() noexcept {
+        if (m_ring) std::exchange(m_ring, nullptr)->recycle(m_id);
+    }
+
+    BufferRing::Received BufferRing::lease(int32_t result, uint32_t flags) noexcept {
+        if (!(flags & IORING_CQE_F_BUFFER)) return Received{detail::map_result(result), Lease{}};
+        const auto id = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+        const auto size = result > 0 ? static_cast<size_t>(result) : 0;
+        return Received{detail::map_result(result), Lease{this, id, buffer(id), size}};
+    }
+
+    std::unique_ptr<BufferRing> buffer_ring(unsigned count, size_t size) {
+        if (!count || count > 32768 || (count & (count - 1)) || !size) throw exception_errc(IO_EINVAL);
+        return std::make_unique<BufferRingImpl>(count, size);
+    }
+
+    // validated ahead of rounding, which would divide by a zero alignment
+    static size_t aligned_size(size_t size, size_t alignment) {
+        if (!alignment || (alignment & (alignment - 1))) throw exception_errc(IO_EINVAL);
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    AlignedBuffer::AlignedBuffer(size_t size, size_t alignment) : m_size(aligned_size(size, alignment)) {
+        m_data = static_cast<std::byte *>(std::aligned_alloc(alignment, m_size ? m_size : alignment));
+        if (!m_data) throw exception_errc(IO_ENOMEM);
+    }
+
+    AlignedBuffer &AlignedBuffer::operator=(AlignedBuffer &&other) noexcept {
+        if (this != &other) {
+            std::free(m_data);
+            m_data = std::exchange(other.m_data, nullptr), m_size = other.m_size;
+        }
+        return *this;
+    }
+
+    AlignedBuffer::~AlignedBuffer() noexcept { std::free(m_data); }
+
+    std::unique_ptr<FixedBufferPool> fixed_buffer_pool(size_t count, size_t size) {
+        // buffer indices are 16 bits wide in the submission entries
+        if (!count || !size || count > UINT16_MAX) throw exception_errc(IO_EINVAL);
+        return std::make_unique<FixedBufferPoolImpl>(count, size);
+    }
+}
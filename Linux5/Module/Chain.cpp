@@ -0,0 +1,83 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include "Uring.h"
+
+namespace {
+    using namespace kls::io;
+    using namespace kls::io::detail;
+
+    void prepare(io_uring_sqe *sqe, const LinkedOp &op) noexcept {
+        const FileRef file{op.fd, op.fixed_file};
+        switch (op.kind) {
+            case LinkedOp::Read:
+                return io_pack_args<IoOps::Read>(sqe, file, op.data, unsigned(op.size), op.offset);
+            case LinkedOp::Write:
+                return io_pack_args<IoOps::Write>(sqe, file, op.data, unsigned(op.size), op.offset);
+            case LinkedOp::ReadV:
+                return io_pack_args<IoOps::ReadV>(
+                        sqe, file, static_cast<const iovec *>(op.data), unsigned(op.size), op.offset
+                );
+            case LinkedOp::WriteV:
+                return io_pack_args<IoOps::WriteV>(
+                        sqe, file, static_cast<const iovec *>(op.data), unsigned(op.size), op.offset
+                );
+            case LinkedOp::ReadFixed:
+                return io_pack_args<IoOps::ReadFixed>(sqe, file, op.data, unsigned(op.size), op.offset, int(op.buffer));
+            case LinkedOp::WriteFixed:
+                return io_pack_args<IoOps::WriteFixed>(sqe, file, op.data, unsigned(op.size), op.offset, int(op.buffer));
+            case LinkedOp::Sync:
+                return io_pack_args<IoOps::Sync>(sqe, file, IORING_FSYNC_DATASYNC);
+            case LinkedOp::SyncAll:
+                return io_pack_args<IoOps::Sync>(sqe, file, 0u);
+            case LinkedOp::Send:
+                return io_pack_args<IoOps::Send>(sqe, file, op.data, size_t(op.size), 0);
+            case LinkedOp::Recv:
+                return io_pack_args<IoOps::Recv>(sqe, file, op.data, size_t(op.size), 0);
+            case LinkedOp::Refused:
+                return io_uring_prep_nop(sqe); // never submitted, the chain is refused before
+        }
+    }
+}
+
+namespace kls::io::detail {
+    void submit_chain(ChainLink *links, const LinkedOp *ops, size_t count, bool hard) noexcept {
+        const auto ring = IoRing::get();
+        // the whole chain has to fit the submission queue at once, and the kernel takes 32 bit lengths
+        auto valid = count <= ring->ring().sq.ring_entries;
+        for (size_t i = 0; valid && i < count; ++i) valid = ops[i].kind != LinkedOp::Refused && ops[i].size <= UINT32_MAX;
+        if (!valid) {
+            for (size_t i = 0; i < count; ++i) links[i].result = -EINVAL, IoRing::finish(links[i].await, -EINVAL);
+            return;
+        }
+        std::lock_guard lk{ring->lock()};
+        // room for the whole chain up front, a submission in between would cut the links
+        for (size_t i = 0; i < count; ++i) {
+            const auto sqe = ring->get_sqe(i == 0 ? count : 1);
+            prepare(sqe, ops[i]);
+            if (i + 1 < count) sqe->flags |= hard ? IOSQE_IO_HARDLINK : IOSQE_IO_LINK;
+            io_uring_sqe_set_data(sqe, tag(&links[i]));
+        }
+        ring->adopt(links[0].await);
+        ring->submit();
+    }
+}
@@ -27,7 +27,9 @@
 
 namespace kls::io::detail {
     Status map_error(int32_t sys) noexcept {
-        switch(sys) {
+        // completions carry negated error codes, while errno is positive
+        switch(sys < 0 ? -sys : sys) {
+            case 0: return IO_OK;
             case EACCES: return IO_EACCES;
             case EADDRINUSE: return IO_EADDRINUSE;
             case EADDRNOTAVAIL: return IO_EADDRNOTAVAIL;
@@ -84,7 +86,6 @@ namespace kls::io::detail {
             case ETIMEDOUT: return IO_ETIMEDOUT;
             case ETXTBSY: return IO_ETXTBSY;
             case EXDEV: return IO_EXDEV;
-            case EOF: return IO_EOF;
             case ENXIO: return IO_ENXIO;
             case EMLINK: return IO_EMLINK;
             case ENOTTY: return IO_ENOTTY;
@@ -0,0 +1,205 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <deque>
+#include <mutex>
+#include <exception>
+#include <vector>
+#include <limits.h>
+#include <sys/stat.h>
+#include "kls/io/Log.h"
+#include "kls/thread/SpinLock.h"
+#include "kls/coroutine/Trigger.h"
+
+namespace {
+    using namespace kls;
+    using namespace kls::io;
+    using namespace kls::essential;
+
+    // An appender waiting for the batch that carries its data, or for its turn to write that batch itself
+    struct Waiter : private coroutine::SingleExecutorTrigger, private coroutine::ExecutorAwaitEntry {
+        Span<> data;
+        uint64_t offset{};
+
+        explicit Waiter(Span<> data) noexcept: data(data) {}
+
+        [[nodiscard]] constexpr bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> h) {
+            ExecutorAwaitEntry::set_handle(h);
+            return SingleExecutorTrigger::trap(*this);
+        }
+
+        [[nodiscard]] Status await_resume() const noexcept { return m_status; }
+
+        [[nodiscard]] bool leads() const noexcept { return m_lead; }
+
+        // the waiter may be gone as soon as these return
+        void release(Status status) { m_status = status, SingleExecutorTrigger::pull(); }
+
+        void promote() { m_lead = true, SingleExecutorTrigger::pull(); }
+    private:
+        Status m_status{IO_OK};
+        bool m_lead{false};
+    };
+
+    class AppendLogImpl : public AppendLog {
+    public:
+        AppendLogImpl(SafeHandle<Block> file, uint64_t end, uint64_t segment) :
+                m_file(std::move(file)), m_end(end), m_allocated(end), m_segment(segment) {}
+
+        coroutine::ValueAsync<uint64_t> append(Span<> data) override {
+            Waiter waiter{data};
+            bool lead;
+            {
+                std::lock_guard lk{m_lock};
+                if (m_failed != IO_OK) throw exception_errc(m_failed);
+                waiter.offset = std::exchange(m_end, m_end + data.size());
+                m_queue.push_back(&waiter);
+                lead = !std::exchange(m_flushing, true);
+            }
+            // the first appender to find nobody writing leads, the others wait for a leader to either write
+            //     their data or hand them the lead, so nobody writes more than the one batch holding its own data
+            if (!lead) {
+                const auto status = co_await waiter;
+                if (!waiter.leads()) {
+                    if (status != IO_OK) throw exception_errc(status);
+                    co_return waiter.offset;
+                }
+            }
+            if (const auto status = co_await flush(waiter); status != IO_OK) throw exception_errc(status);
+            co_return waiter.offset;
+        }
+
+        IOAwait<Status> close() noexcept override { return (*m_file).close(); }
+    private:
+        // a writev takes at most IOV_MAX buffers and reports up to 2 GiB
+        static constexpr size_t max_buffers = IOV_MAX;
+        static constexpr uint64_t max_bytes = 1u << 30;
+
+        SafeHandle<Block> m_file;
+        thread::SpinLock m_lock{};
+        std::deque<Waiter *> m_queue{};
+        uint64_t m_end;
+        bool m_flushing{false};
+        Status m_failed{IO_OK};
+        // only touched by the appender leading
+        uint64_t m_allocated;
+        const uint64_t m_segment;
+        std::vector<Waiter *> m_batch{};
+        std::vector<IoVec> m_vec{};
+
+        Block &file() noexcept { return *m_file; }
+
+        // Writes the batch starting at `self`, which is always at the front of the queue when it leads
+        coroutine::ValueAsync<Status> flush(Waiter &self) {
+            {
+                std::lock_guard lk{m_lock};
+                m_batch.clear();
+                uint64_t bytes = 0;
+                while (!m_queue.empty() && m_batch.size() < max_buffers) {
+                    const auto next = m_queue.front();
+                    if (!m_batch.empty() && bytes + next->data.size() > max_bytes) break;
+                    bytes += next->data.size();
+                    m_batch.push_back(next);
+                    m_queue.pop_front();
+                }
+            }
+            auto status = IO_OK;
+            std::exception_ptr error{};
+            // the batch still has to be released and the lead passed on, or every appender would wait forever
+            try { status = co_await commit(); }
+            catch (...) { error = std::current_exception(), status = fail(IO_UNKNOWN); }
+            for (const auto waiter: m_batch) if (waiter != &self) waiter->release(status);
+            // done with the batch, whoever leads next is free to reuse it
+            Waiter *next = nullptr;
+            {
+                std::lock_guard lk{m_lock};
+                if (m_queue.empty()) m_flushing = false; else next = m_queue.front();
+            }
+            if (next) next->promote();
+            if (error) std::rethrow_exception(error);
+            co_return status;
+        }
+
+        coroutine::ValueAsync<Status> commit() {
+            if (const auto failed = failure(); failed != IO_OK) co_return failed;
+            const auto start = m_batch.front()->offset;
+            const auto end = m_batch.back()->offset + m_batch.back()->data.size();
+            if (end > m_allocated) {
+                const auto grow = (end - m_allocated + m_segment - 1) / m_segment * m_segment;
+                // only spares the writes from allocating extents, so a failure here is no failure of the log
+                if (co_await file().allocate(m_allocated, grow, Block::A_KEEP_SIZE) == IO_OK) m_allocated += grow;
+                else m_allocated = end;
+            }
+            m_vec.clear();
+            for (const auto waiter: m_batch) m_vec.emplace_back(waiter->data);
+            const auto [write, sync] = co_await chain(
+                    file().writev_op(Span<IoVec>(m_vec.data(), m_vec.size()), start), file().sync_op()
+            );
+            if (!write.success()) co_return fail(write.error());
+            if (start + write.result() == end) co_return sync.success() ? IO_OK : fail(sync.error());
+            // a short write cuts the chain before the sync, write the rest on its own
+            if (const auto status = co_await rest(start + write.result()); status != IO_OK) co_return fail(status);
+            if (const auto status = co_await file().sync(); status != IO_OK) co_return fail(status);
+            co_return IO_OK;
+        }
+
+        coroutine::ValueAsync<Status> rest(uint64_t position) {
+            for (const auto waiter: m_batch) {
+                const auto stop = waiter->offset + waiter->data.size();
+                const auto base = reinterpret_cast<std::byte *>(waiter->data.data());
+                for (auto at = std::max(position, waiter->offset); at < stop;) {
+                    const auto res = co_await file().write(Span<>(base + (at - waiter->offset), stop - at), at);
+                    if (!res.success()) co_return res.error();
+                    if (res.result() == 0) co_return IO_EIO;
+                    at += res.result();
+                }
+            }
+            co_return IO_OK;
+        }
+
+        Status failure() noexcept {
+            std::lock_guard lk{m_lock};
+            return m_failed;
+        }
+
+        Status fail(Status status) noexcept {
+            std::lock_guard lk{m_lock};
+            return m_failed = status;
+        }
+    };
+}
+
+namespace kls::io {
+    coroutine::ValueAsync<std::unique_ptr<AppendLog>> append_log(std::string_view path, uint64_t segment) {
+        if (!segment) throw exception_errc(IO_EINVAL);
+        auto file = co_await Block::open(path, Block::F_READ | Block::F_WRITE | Block::F_CREAT);
+        struct stat info{};
+        if (fstat((*file).value(), &info) != 0) {
+            const auto code = errno;
+            co_await (*file).close();
+            throw exception_errc(detail::map_error(code));
+        }
+        co_return std::make_unique<AppendLogImpl>(std::move(file), static_cast<uint64_t>(info.st_size), segment);
+    }
+}
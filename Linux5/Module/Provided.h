@@ -0,0 +1,49 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include "Uring.h"
+#include "kls/io/Buffer.h"
+
+namespace kls::io::detail {
+    class BufferRingImpl : public BufferRing {
+    public:
+        BufferRingImpl(unsigned count, size_t size);
+        ~BufferRingImpl() noexcept override;
+        [[nodiscard]] IoRing *ring() const noexcept { return m_ring; }
+        [[nodiscard]] uint16_t group() const noexcept { return m_group; }
+        [[nodiscard]] size_t size() const noexcept { return m_size; }
+    protected:
+        [[nodiscard]] std::byte *buffer(uint16_t id) noexcept override { return m_memory.get() + id * m_size; }
+        void recycle(uint16_t id) noexcept override;
+    private:
+        SafeHandle<Uring> m_core = Uring::get();
+        IoRing *const m_ring = IoRing::get();
+        const unsigned m_count;
+        const size_t m_size;
+        const uint16_t m_group;
+        std::unique_ptr<std::byte[]> m_memory;
+        io_uring_buf_ring *m_buffers{};
+        thread::SpinLock m_lock{};
+    };
+}
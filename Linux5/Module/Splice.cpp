@@ -0,0 +1,63 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include "Uring.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace kls::io::detail {
+    coroutine::ValueAsync<Status> splice_through(int in, uint64_t offset, int out, int64_t at, uint64_t length) {
+        int pipe[2];
+        if (pipe2(pipe, O_CLOEXEC) != 0) co_return map_error(errno);
+        // a larger pipe moves more per round trip. Raising it fails past /proc/sys/fs/pipe-max-size,
+        //     which leaves the pipe as it was
+        fcntl(pipe[1], F_SETPIPE_SZ, 1 << 20);
+        const auto capacity = static_cast<uint64_t>(std::max(fcntl(pipe[1], F_GETPIPE_SZ), 4096));
+        auto status = IO_OK;
+        while (length && status == IO_OK) {
+            const auto chunk = static_cast<unsigned>(std::min(length, capacity));
+            const auto filled = co_await io_plain<IOResult, IoOps::Splice>(
+                    in, static_cast<int64_t>(offset), pipe[1], int64_t(-1), chunk, unsigned(SPLICE_F_MOVE)
+            );
+            if (!filled.success() || !filled.result()) {
+                status = filled.success() ? IO_EIO : filled.error();
+                break;
+            }
+            // the pipe is drained completely before refilling, so what is in it always belongs to this chunk
+            for (auto left = filled.result(); left > 0;) {
+                const auto drained = co_await io_plain<IOResult, IoOps::Splice>(
+                        pipe[0], int64_t(-1), out, at, static_cast<unsigned>(left), unsigned(SPLICE_F_MOVE)
+                );
+                if (!drained.success() || !drained.result()) {
+                    status = drained.success() ? IO_EIO : drained.error();
+                    break;
+                }
+                left -= drained.result();
+                if (at >= 0) at += drained.result();
+            }
+            offset += filled.result(), length -= filled.result();
+        }
+        close(pipe[0]), close(pipe[1]);
+        co_return status;
+    }
+}
@@ -22,11 +22,25 @@
 
 #include "IP.h"
 #include "Uring.h"
+#include "Provided.h"
 #include "kls/io/TCP.h"
+#include <linux/filter.h>
 
 namespace kls::io::detail {
     struct TCPHelper {
         static SocketTCP socket(int s) { return SocketTCP{s}; }
+
+        static FileRef file(const SocketTCP &socket) noexcept {
+            return socket.m_slot < 0 ? FileRef{socket.value(), false} : FileRef{socket.m_slot, true};
+        }
+
+        // Notes that an operation on `socket` goes to `ring`, for cancel() to find it there
+        static FileRef file(SocketTCP &socket, IoRing *ring) noexcept {
+            std::atomic_ref rings{socket.m_rings};
+            if (!(rings.load(std::memory_order_relaxed) & ring->bit()))
+                rings.fetch_or(ring->bit(), std::memory_order_relaxed);
+            return file(socket);
+        }
     };
 }
 
@@ -36,10 +50,13 @@ namespace {
     using namespace kls::io::detail;
     using namespace kls::essential;
 
+    using PSAddr = sockaddr *;
+
     class AcceptImpl : public AcceptorTCP {
     public:
         explicit AcceptImpl(int socket) noexcept: mFd(socket) {}
         IOAwait<Status> close() noexcept override {
+            // wakes the accepts in flight on whatever ring they went to, which then fail
             shutdown(mFd, SHUT_RDWR);
             return io_plain<Status, IoOps::Close>(mFd);
         }
@@ -50,32 +67,123 @@ namespace {
         IOAwait<IOResult> accept(sockaddr *address, socklen_t &len) noexcept {
             return io_plain<IOResult, IoOps::Accept>(mFd, address, &len, 0);
         }
+
+        TimedAwait<IOAwait<IOResult>> accept(sockaddr *address, socklen_t &len, std::chrono::nanoseconds limit) noexcept {
+            return io_timed<IOResult, IoOps::Accept>(limit, mFd, address, &len, 0);
+        }
+
+        template<class SockIn>
+        coroutine::ValueAsync<Result> accept_within(std::chrono::nanoseconds limit) {
+            SockIn peer{};
+            socklen_t len{sizeof(peer)};
+            const auto res = co_await accept(PSAddr(&peer), len, limit);
+            if (!res.success()) throw exception_errc(res.error());
+            co_return Result{.peer = from_os_ip(peer), .handle = SafeHandle{TCPHelper::socket(res.get_result())}};
+        }
     };
 
-    using PSAddr = sockaddr *;
+    class RecvStreamCore : public RingCore {
+    public:
+        RecvStreamCore(IoRing *ring, BufferRing &buffers) noexcept: RingCore(ring), m_buffers(buffers) {}
+
+        ~RecvStreamCore() noexcept override {
+            // hand back the buffers of the completions nobody consumed
+            for (const auto [result, flags]: m_queue) static_cast<void>(m_buffers.lease(result, flags));
+        }
+    private:
+        BufferRing &m_buffers;
+    };
+
+    class AcceptStreamCore : public RingCore {
+    public:
+        AcceptStreamCore(IoRing *ring, size_t capacity) noexcept: RingCore(ring) { m_capacity = capacity; }
+
+        ~AcceptStreamCore() noexcept override {
+            // close the connections nobody picked up
+            for (const auto [result, flags]: m_queue) if (result >= 0) ::close(result);
+        }
+    };
+
+    template<class SockIn>
+    class AcceptStreamImpl : public AcceptStream {
+    public:
+        AcceptStreamImpl(int socket, size_t capacity) : m_fd(socket), m_capacity(capacity) { arm(); }
+
+        ~AcceptStreamImpl() noexcept override {
+            if (!m_stream->done()) m_stream->cancel();
+            m_stream->drop();
+        }
+
+        coroutine::ValueAsync<AcceptorTCP::Result> next() override {
+            for (;;) {
+                const auto [res, flags] = co_await m_stream->next();
+                if (res >= 0) {
+                    SockIn peer{};
+                    socklen_t len{sizeof(peer)};
+                    getpeername(res, PSAddr(&peer), &len);
+                    co_return AcceptorTCP::Result{.peer = from_os_ip(peer), .handle = SafeHandle{TCPHelper::socket(res)}};
+                }
+                if (flags & IORING_CQE_F_MORE) continue; // the connection failed, the stream goes on
+                if (!m_stream->throttled()) throw exception_errc(map_error(-res));
+                // the queue had filled up and accepting was paused, it has just been drained so resume
+                m_stream->drop();
+                arm();
+            }
+        }
+    private:
+        const int m_fd;
+        const size_t m_capacity;
+        SafeHandle<Uring> m_core = Uring::get();
+        AcceptStreamCore *m_stream{};
+
+        void arm() {
+            const auto ring = IoRing::get();
+            m_stream = new AcceptStreamCore(ring, m_capacity);
+            io_submit_on(ring, [this](io_uring_sqe *sqe) noexcept {
+                io_uring_prep_multishot_accept(sqe, m_fd, nullptr, nullptr, 0);
+                io_uring_sqe_set_data(sqe, tag(m_stream));
+            });
+        }
+    };
 
     class AcceptImpl4 : public AcceptImpl {
     public:
         using AcceptImpl::AcceptImpl;
 
+        std::unique_ptr<AcceptStream> stream(size_t backlog) override {
+            return std::make_unique<AcceptStreamImpl<sockaddr_in>>(mFd, backlog);
+        }
+
         coroutine::ValueAsync<Result> once() override {
             sockaddr_in peer{};
             socklen_t len{sizeof(peer)};
             const auto res = (co_await accept(PSAddr(&peer), len)).get_result();
             co_return Result{.peer = from_os_ip(peer), .handle = SafeHandle{TCPHelper::socket(res)}};
         }
+
+        coroutine::ValueAsync<Result> once(std::chrono::nanoseconds limit) override {
+            return accept_within<sockaddr_in>(limit);
+        }
     };
 
     class AcceptImpl6 : public AcceptImpl {
     public:
         using AcceptImpl::AcceptImpl;
 
+        std::unique_ptr<AcceptStream> stream(size_t backlog) override {
+            return std::make_unique<AcceptStreamImpl<sockaddr_in6>>(mFd, backlog);
+        }
+
         coroutine::ValueAsync<Result> once() override {
             sockaddr_in6 peer{};
             socklen_t len{sizeof(peer)};
             const auto res = (co_await accept(PSAddr(&peer), len)).get_result();
             co_return Result{.peer = from_os_ip(peer), .handle = SafeHandle{TCPHelper::socket(res)}};
         }
+
+        coroutine::ValueAsync<Result> once(std::chrono::nanoseconds limit) override {
+            return accept_within<sockaddr_in6>(limit);
+        }
     };
 
     template<class SockAdr>
@@ -107,43 +215,88 @@ namespace {
         throw exception_errc(map_error(errno));
     }
 
-    std::unique_ptr<AcceptorTCP> acceptor4(Address address, int port, int backlog) {
-        const auto sock = socket(AF_INET, SOCK_STREAM, 0);
+    template<class SockAdr>
+    coroutine::ValueAsync<SafeHandle<SocketTCP>> connect_within(SockAdr address, std::chrono::nanoseconds limit) {
+        const auto core = Uring::get();
+        const auto sock = socket(reinterpret_cast<const sockaddr &>(address).sa_family, SOCK_STREAM, 0);
+        if (sock == -1) throw exception_errc(map_error(errno));
+        const auto res = co_await io_timed<IOResult, IoOps::Connect>(limit, sock, PSAddr(&address), sizeof(SockAdr));
+        if (res.success()) co_return SafeHandle{TCPHelper::socket(sock)};
+        close(sock);
+        throw exception_errc(res.error());
+    }
+
+    template<class SockIn>
+    int listener(const SockIn &target, int backlog, bool reuse_port) noexcept {
+        const auto sock = socket(reinterpret_cast<const sockaddr &>(target).sa_family, SOCK_STREAM, 0);
         if (sock != -1) {
             int enable = 1;
-            sockaddr_in target = to_os_ipv4(address, port);
             if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0) goto error;
+            if (reuse_port && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(int)) < 0) goto error;
             if (bind(sock, PSAddr(&target), sizeof(target)) == -1) goto error;
-            if (listen(sock, backlog) != -1) return std::make_unique<AcceptImpl4>(sock);
+            if (listen(sock, backlog) != -1) return sock;
             error:
             close(sock);
         }
+        return -1;
+    }
+
+    std::unique_ptr<AcceptorTCP> acceptor4(Address address, int port, int backlog) {
+        if (const auto sock = listener(to_os_ipv4(address, port), backlog, false); sock != -1)
+            return std::make_unique<AcceptImpl4>(sock);
         throw exception_errc(map_error(errno));
     }
 
     std::unique_ptr<AcceptorTCP> acceptor6(Address address, int port, int backlog) {
-        const auto sock = socket(AF_INET6, SOCK_STREAM, 0);
-        if (sock != -1) {
-            sockaddr_in6 target = to_os_ipv6(address, port);
-            int enable = 1;
-            if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0) goto error;
-            if (bind(sock, PSAddr(&target), sizeof(target)) == -1) goto error;
-            if (listen(sock, backlog) != -1) return std::make_unique<AcceptImpl6>(sock);
-            error:
-            close(sock);
-        }
+        if (const auto sock = listener(to_os_ipv6(address, port), backlog, false); sock != -1)
+            return std::make_unique<AcceptImpl6>(sock);
         throw exception_errc(map_error(errno));
     }
+
+    // Picks the listener of the reuse port group by the CPU the connection came in on
+    bool steer_by_cpu(int sock, int shards) noexcept {
+        sock_filter code[] = {
+                {BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)},
+                {BPF_ALU | BPF_MOD | BPF_K, 0, 0, static_cast<uint32_t>(shards)},
+                {BPF_RET | BPF_A, 0, 0, 0}
+        };
+        sock_fprog program{.len = static_cast<unsigned short>(std::size(code)), .filter = code};
+        return setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == 0;
+    }
+
+    template<class Impl, class SockIn>
+    std::vector<std::unique_ptr<AcceptorTCP>> sharded(const SockIn &target, int backlog, int shards, bool steer) {
+        std::vector<int> socks{};
+        for (int i = 0; i < shards; ++i) {
+            if (const auto sock = listener(target, backlog, true); sock != -1) socks.push_back(sock); else goto error;
+        }
+        // the program is shared by the whole group, and listener indices follow the order they joined in
+        if (steer && !steer_by_cpu(socks.front(), shards)) goto error;
+        {
+            std::vector<std::unique_ptr<AcceptorTCP>> result{};
+            for (const auto sock: socks) result.push_back(std::make_unique<Impl>(sock));
+            return result;
+        }
+        error:
+        const auto code = errno;
+        for (const auto sock: socks) close(sock);
+        throw exception_errc(map_error(code));
+    }
 }
 
 namespace kls::io {
+    // The file to submit an operation on `socket` with, to the ring of the calling thread unless told otherwise
+    static FileRef file(SocketTCP &socket, IoRing *ring = IoRing::get()) noexcept {
+        return TCPHelper::file(socket, ring);
+    }
+
     template<IoOps Op>
-    static IOAwait<IOResult> simple(int fd, Span<> buffer) {
+    static IOAwait<IOResult> simple(FileRef fd, Span<> buffer) {
         return io_plain<IOResult, Op>(fd, buffer.data(), buffer.size(), 0);
     }
 
     template<IoOps Op>
-    static VecAwait aggregated(int fd, Span<iovec> vec) {
+    static VecAwait aggregated(FileRef fd, Span<iovec> vec) {
         msghdr message{
                 .msg_name = nullptr, .msg_namelen = 0,
                 .msg_iov = vec.data(), .msg_iovlen = vec.size(),
@@ -152,25 +305,148 @@ namespace kls::io {
         return io_message<Op>(fd, message, 0);
     }
 
+    template<IoOps Op>
+    static TimedAwait<VecAwait> aggregated(FileRef fd, Span<iovec> vec, std::chrono::nanoseconds limit) {
+        msghdr message{
+                .msg_name = nullptr, .msg_namelen = 0,
+                .msg_iov = vec.data(), .msg_iovlen = vec.size(),
+                .msg_control = nullptr, .msg_controllen = 0, .msg_flags = 0
+        };
+        return io_message_timed<Op>(limit, fd, message, 0);
+    }
+
     SocketTCP::SocketTCP(int h) : Handle<int>([c = Uring::get()](int h) noexcept {}, h) {}
 
-    IOAwait<IOResult> SocketTCP::read(Span<> buffer) noexcept { return simple<IoOps::Recv>(value(), buffer); }
+    IOAwait<IOResult> SocketTCP::read(Span<> buffer) noexcept {
+        return simple<IoOps::Recv>(file(*this), buffer);
+    }
+
+    IOAwait<IOResult> SocketTCP::write(Span<> buffer) noexcept {
+        return simple<IoOps::Send>(file(*this), buffer);
+    }
 
-    IOAwait<IOResult> SocketTCP::write(Span<> buffer) noexcept { return simple<IoOps::Send>(value(), buffer); }
+    IOAwait<IOResult> SocketTCP::send_zc(Span<> buffer, size_t threshold) noexcept {
+        if (buffer.size() < threshold) return write(buffer);
+        return io_plain<IOResult, IoOps::SendZc>(file(*this), buffer.data(), buffer.size(), 0, 0);
+    }
 
     VecAwait SocketTCP::readv(Span<IoVec> vec) noexcept {
-        return aggregated<IoOps::RecvMsg>(value(), reinterpret_span_cast<iovec>(vec));
+        return aggregated<IoOps::RecvMsg>(file(*this), reinterpret_span_cast<iovec>(vec));
     }
 
     VecAwait SocketTCP::writev(Span<IoVec> vec) noexcept {
-        return aggregated<IoOps::SendMsg>(value(), reinterpret_span_cast<iovec>(vec));
+        return aggregated<IoOps::SendMsg>(file(*this), reinterpret_span_cast<iovec>(vec));
+    }
+
+    LinkedOp SocketTCP::read_op(Span<> buffer) noexcept {
+        const auto fd = file(*this);
+        return LinkedOp{
+                .kind = LinkedOp::Recv, .fd = fd.fd, .fixed_file = fd.fixed, .buffer = 0,
+                .data = buffer.data(), .size = buffer.size(), .offset = 0
+        };
+    }
+
+    LinkedOp SocketTCP::write_op(Span<> buffer) noexcept {
+        const auto fd = file(*this);
+        return LinkedOp{
+                .kind = LinkedOp::Send, .fd = fd.fd, .fixed_file = fd.fixed, .buffer = 0,
+                .data = buffer.data(), .size = buffer.size(), .offset = 0
+        };
+    }
+
+    TimedAwait<IOAwait<IOResult>> SocketTCP::read(Span<> buffer, std::chrono::nanoseconds limit) noexcept {
+        return io_timed<IOResult, IoOps::Recv>(limit, file(*this), buffer.data(), buffer.size(), 0);
+    }
+
+    TimedAwait<IOAwait<IOResult>> SocketTCP::write(Span<> buffer, std::chrono::nanoseconds limit) noexcept {
+        return io_timed<IOResult, IoOps::Send>(limit, file(*this), buffer.data(), buffer.size(), 0);
+    }
+
+    TimedAwait<VecAwait> SocketTCP::readv(Span<IoVec> vec, std::chrono::nanoseconds limit) noexcept {
+        return aggregated<IoOps::RecvMsg>(file(*this), reinterpret_span_cast<iovec>(vec), limit);
+    }
+
+    TimedAwait<VecAwait> SocketTCP::writev(Span<IoVec> vec, std::chrono::nanoseconds limit) noexcept {
+        return aggregated<IoOps::SendMsg>(file(*this), reinterpret_span_cast<iovec>(vec), limit);
+    }
+
+    VecAwait SocketTCP::sendmsg_zc(Span<IoVec> vec, size_t threshold) noexcept {
+        size_t total = 0;
+        for (const auto &v: reinterpret_span_cast<iovec>(vec)) total += v.iov_len;
+        if (total < threshold) return writev(vec);
+        return aggregated<IoOps::SendMsgZc>(file(*this), reinterpret_span_cast<iovec>(vec));
+    }
+
+    SelectAwait SocketTCP::recv_select(BufferRing &buffers) noexcept {
+        auto &group = static_cast<BufferRingImpl &>(buffers);
+        const auto ring = group.ring();
+        // the kernel would refuse the submission without completing anything, so nothing would resume us
+        if (ring->foreign()) return SelectAwait{buffers, [](SelectAwait *ths) noexcept { IoRing::finish(ths, -EEXIST); }};
+        const auto fd = file(*this, ring);
+        std::lock_guard lk{ring->lock()};
+        return SelectAwait{
+                buffers, [&](SelectAwait *ths) noexcept {
+                    const auto sqe = ring->get_sqe();
+                    io_pack_args<IoOps::Recv>(sqe, fd, nullptr, group.size(), 0);
+                    sqe->flags |= IOSQE_BUFFER_SELECT;
+                    sqe->buf_group = group.group();
+                    ring->attach(sqe, ths);
+                    ring->submit();
+                }
+        };
+    }
+
+    RecvStream SocketTCP::recv_stream(BufferRing &buffers) {
+        auto &group = static_cast<BufferRingImpl &>(buffers);
+        const auto core = new RecvStreamCore(group.ring(), buffers);
+        if (group.ring()->foreign()) {
+            IoRing::finish(core, -EEXIST);
+            return RecvStream{core, buffers};
+        }
+        const auto fd = file(*this, group.ring());
+        io_submit_on(group.ring(), [&](io_uring_sqe *sqe) noexcept {
+            io_pack_args<IoOps::RecvMulti>(sqe, fd, nullptr, 0, 0);
+            sqe->flags |= IOSQE_BUFFER_SELECT;
+            sqe->buf_group = group.group();
+            io_uring_sqe_set_data(sqe, tag(core));
+        });
+        return RecvStream{core, buffers};
+    }
+
+    RecvStream::~RecvStream() noexcept {
+        if (!m_core) return;
+        if (!m_core->done()) m_core->cancel();
+        m_core->drop();
+    }
+
+    void SocketTCP::cancel() noexcept {
+        IoContext::get().cancel(TCPHelper::file(*this), std::atomic_ref{m_rings}.load(std::memory_order_relaxed));
     }
 
     IOAwait<Status> SocketTCP::close() noexcept {
+        // wakes the operations in flight, receives then end and sends fail
         shutdown(value(), SHUT_RDWR);
+        if (m_slot >= 0) IoContext::get().unregister_file(std::exchange(m_slot, -1));
         return io_plain<Status, IoOps::Close>(value());
     }
 
+    Status SocketTCP::register_file() noexcept {
+        if (m_slot >= 0) return IO_OK;
+        if (const auto slot = IoContext::get().register_file(value()); slot >= 0) return (m_slot = slot, IO_OK);
+        else return map_error(-slot);
+    }
+
+    coroutine::ValueAsync<SafeHandle<SocketTCP>> connect(Address address, int port, std::chrono::nanoseconds limit) {
+        switch (address.family()) {
+            case Address::AF_IPv4:
+                return connect_within(to_os_ipv4(address, port), limit);
+            case Address::AF_IPv6:
+                return connect_within(to_os_ipv6(address, port), limit);
+            default:
+                throw std::runtime_error("Invalid Peer Family");
+        }
+    }
+
     coroutine::ValueAsync<SafeHandle<SocketTCP>> connect(Address address, int port) {
         switch (address.family()) {
             case Address::AF_IPv4:
@@ -182,6 +458,20 @@ namespace kls::io {
         }
     }
 
+    std::vector<std::unique_ptr<AcceptorTCP>> acceptor_tcp_sharded(
+            Address address, int port, int backlog, int shards, bool steer
+    ) {
+        if (shards <= 0) throw exception_errc(IO_EINVAL);
+        switch (address.family()) {
+            case Address::AF_IPv4:
+                return sharded<AcceptImpl4>(to_os_ipv4(address, port), backlog, shards, steer);
+            case Address::AF_IPv6:
+                return sharded<AcceptImpl6>(to_os_ipv6(address, port), backlog, shards, steer);
+            default:
+                throw std::runtime_error("Invalid Peer Family");
+        }
+    }
+
     std::unique_ptr<AcceptorTCP> acceptor_tcp(Address address, int port, int backlog) {
         switch (address.family()) {
             case Address::AF_IPv4:
@@ -192,4 +482,9 @@ namespace kls::io {
                 throw std::runtime_error("Invalid Peer Family");
         }
     }
+
+    coroutine::ValueAsync<Status> send_file(SocketTCP &socket, Block &file, uint64_t offset, uint64_t length) {
+        static_cast<void>(TCPHelper::file(socket, IoRing::get()));
+        return splice_through(file.value(), offset, socket.value(), -1, length);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,119 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include "Uring.h"
+#include "kls/io/Timer.h"
+#include <algorithm>
+
+namespace {
+    using namespace kls;
+    using namespace kls::io;
+    using namespace kls::io::detail;
+    using namespace kls::essential;
+
+    class TimerCore : public RingCore {
+    public:
+        TimerCore(IoRing *ring, std::chrono::nanoseconds period) noexcept: RingCore(ring), m_period(period) {
+            m_capacity = 64, m_lossy = true;
+        }
+
+        [[nodiscard]] __kernel_timespec *period() noexcept { return m_period.spec(); }
+    private:
+        // read by the kernel when it prepares the timeout, which may happen after submission
+        TimeoutSpec m_period;
+    };
+
+    class TimerImpl : public Timer {
+    public:
+        explicit TimerImpl(std::chrono::nanoseconds period) : m_period(period) { arm(); }
+
+        ~TimerImpl() noexcept override {
+            if (!m_timer->done()) m_timer->cancel();
+            m_timer->drop();
+        }
+
+        coroutine::ValueAsync<Status> next() override {
+            for (;;) {
+                const auto [result, flags] = co_await m_timer->next();
+                if (result == -ETIME) {
+                    // a one shot timeout has to be renewed after every tick
+                    if (!(flags & IORING_CQE_F_MORE)) rearm();
+                    co_return IO_OK;
+                }
+                // multishot timeouts need Linux 6.4, older kernels refuse them
+                if (result == -EINVAL && m_multishot) m_multishot = false;
+                else if (!m_timer->throttled()) co_return map_error(result);
+                // the ticks nobody waited for have been dropped, start over from now
+                rearm();
+            }
+        }
+    private:
+        const std::chrono::nanoseconds m_period;
+        bool m_multishot{true};
+        SafeHandle<Uring> m_core = Uring::get();
+        TimerCore *m_timer{};
+
+        void arm() {
+            const auto ring = IoRing::get();
+            m_timer = new TimerCore(ring, m_period);
+            io_submit_on(ring, [this](io_uring_sqe *sqe) noexcept {
+                io_uring_prep_timeout(sqe, m_timer->period(), 0, m_multishot ? IORING_TIMEOUT_MULTISHOT : 0);
+                io_uring_sqe_set_data(sqe, tag(m_timer));
+            });
+        }
+
+        void rearm() {
+            m_timer->drop();
+            arm();
+        }
+    };
+
+    template<class Duration>
+    std::chrono::nanoseconds since_epoch(Duration time) noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch());
+    }
+}
+
+namespace kls::io {
+    SleepAwait::SleepAwait(std::chrono::nanoseconds time, unsigned flags) noexcept: TimeoutSpec(time) {
+        const auto ring = IoRing::get();
+        std::lock_guard lk{ring->lock()};
+        const auto sqe = ring->get_sqe();
+        io_uring_prep_timeout(sqe, spec(), 0, flags);
+        ring->attach(sqe, this);
+        ring->submit();
+    }
+
+    SleepAwait sleep_for(std::chrono::nanoseconds duration) noexcept {
+        return SleepAwait{std::max(duration, std::chrono::nanoseconds::zero()), 0};
+    }
+
+    SleepAwait sleep_until(std::chrono::steady_clock::time_point time) noexcept {
+        return SleepAwait{since_epoch(time), IORING_TIMEOUT_ABS};
+    }
+
+    SleepAwait sleep_until(std::chrono::system_clock::time_point time) noexcept {
+        return SleepAwait{since_epoch(time), IORING_TIMEOUT_ABS | IORING_TIMEOUT_REALTIME};
+    }
+
+    std::unique_ptr<Timer> timer(std::chrono::nanoseconds period) { return std::make_unique<TimerImpl>(period); }
+}
@@ -21,39 +21,447 @@
 */
 
 #include "Uring.h"
+#include <optional>
+#include <algorithm>
 
 namespace kls::io::detail {
-    static Storage<IoRing> gIoRing;
+    static Storage<IoContext> gIoContext;
+    static RingConfig gConfig{};
+    static std::atomic_bool gStarted{false};
+    // set on the completion threads of the rings
+    static thread_local bool gReaping{false};
 
-    IoRing::IoRing() {
-        io_uring_queue_init(QUEUE_DEPTH, &m_ring, 0);
-        std::thread([this]() { while (wait_one()); }).detach();
+    namespace {
+        // Binds the calling thread to a ring on its first submission and hands it back when the thread exits.
+        // The held core keeps the context alive for as long as the binding exists
+        struct ThreadRing {
+            std::optional<SafeHandle<Uring>> core{};
+            IoRing *ring{};
+
+            IoRing *bind() noexcept {
+                core.emplace(Uring::get());
+                return (ring = gIoContext.value.acquire());
+            }
+
+            ~ThreadRing() { if (ring) gIoContext.value.release(ring); }
+        };
     }
 
-    IoRing::~IoRing() { io_uring_queue_exit(&m_ring); }
+    static io_uring_params make_params(const RingConfig &config, IoRing *attach) noexcept {
+        io_uring_params params{};
+        if (config.cq_entries) {
+            params.flags |= IORING_SETUP_CQSIZE;
+            params.cq_entries = config.cq_entries;
+        }
+        if (config.coop_taskrun) params.flags |= IORING_SETUP_COOP_TASKRUN;
+        // the shared ring is submitted to by any thread, and doubles as the control ring for the others
+        if (config.single_issuer && attach) params.flags |= IORING_SETUP_SINGLE_ISSUER;
+        if (config.sq_poll) {
+            params.flags |= IORING_SETUP_SQPOLL;
+            params.sq_thread_idle = config.sq_poll_idle;
+            if (config.sq_poll_cpu >= 0) {
+                params.flags |= IORING_SETUP_SQ_AFF;
+                params.sq_thread_cpu = static_cast<uint32_t>(config.sq_poll_cpu);
+            }
+            if (attach) {
+                params.flags |= IORING_SETUP_ATTACH_WQ;
+                params.wq_fd = static_cast<uint32_t>(attach->ring().ring_fd);
+            }
+        }
+        return params;
+    }
 
-    IoRing *IoRing::get() noexcept { return &gIoRing.value; }
+    IoRing::IoRing(const RingConfig &config, IoRing *attach, unsigned index) :
+            m_batch(config.deferred_submit ? config.submit_batch : 1),
+            m_poll(config.sq_poll),
+            m_bit(uint64_t(1) << std::min(index, 63u)),
+            m_control(config.single_issuer ? attach : nullptr),
+            m_reaped(std::max(config.reap_batch, 1u)) {
+        auto params = make_params(config, attach);
+        if (const auto ret = io_uring_queue_init_params(config.sq_entries, &m_ring, &params); ret < 0)
+            throw exception_errc(map_error(-ret));
+        if (config.fixed_buffers) {
+            if (const auto ret = io_uring_register_buffers_sparse(&m_ring, config.fixed_buffers); ret < 0) {
+                io_uring_queue_exit(&m_ring);
+                throw exception_errc(map_error(-ret));
+            }
+        }
+        if (config.fixed_files) {
+            if (const auto ret = io_uring_register_files_sparse(&m_ring, config.fixed_files); ret < 0) {
+                io_uring_queue_exit(&m_ring);
+                throw exception_errc(map_error(-ret));
+            }
+        }
+        m_reaper = std::thread([this]() {
+            gReaping = true;
+            while (wait_batch());
+        });
+    }
 
-    io_uring_sqe *IoRing::get_sqe() noexcept {
+    IoRing::~IoRing() {
+        // wake the completion thread up with an empty completion so that it can observe the stop flag
+        m_stop.store(true);
+        if (m_control) m_control->message(*this, nullptr);
+        else {
+            std::lock_guard lk{m_lock};
+            const auto sqe = get_sqe();
+            io_uring_prep_nop(sqe);
+            io_uring_sqe_set_data(sqe, nullptr);
+            io_uring_submit(&m_ring);
+        }
+        // never the completion thread itself, see retire()
+        m_reaper.join();
+        io_uring_queue_exit(&m_ring);
+    }
+
+    IoRing *IoRing::get() noexcept {
+        thread_local ThreadRing local{};
+        if (const auto ring = local.ring; ring) return ring; else return local.bind();
+    }
+
+    io_uring_sqe *IoRing::get_sqe(unsigned reserve) noexcept {
         thread::SpinWait spin{};
-        for (;;) if (const auto sqe = io_uring_get_sqe(&m_ring); sqe) return sqe; else spin.once();
+        for (;;) {
+            if (io_uring_sq_space_left(&m_ring) >= reserve)
+                if (const auto sqe = io_uring_get_sqe(&m_ring); sqe) return sqe;
+            // Push what is queued to the kernel to make room. The kernel refuses new entries while completions
+            //     are backlogged, in which case we back off until the completion thread has drained them.
+            // With a polling kernel thread we can sleep until it has consumed some entries instead
+            if (m_poll) {
+                io_uring_submit(&m_ring);
+                io_uring_sqring_wait(&m_ring);
+            }
+            else if (!io_uring_sq_ready(&m_ring) || io_uring_submit(&m_ring) <= 0) spin.once();
+        }
+    }
+
+    void IoRing::link_timeout(io_uring_sqe *sqe, AwaitCore *await, __kernel_timespec *limit) noexcept {
+        sqe->flags |= IOSQE_IO_LINK;
+        // the timeout always completes as well, either firing or cancelled along with the operation,
+        //     and the await may only resume once both have arrived
+        await->m_pending = 2;
+        const auto timeout = io_uring_get_sqe(&m_ring);
+        io_uring_prep_link_timeout(timeout, limit, 0);
+        io_uring_sqe_set_data(timeout, expiry(await));
+    }
+
+    void IoRing::submit() noexcept {
+        // only the owner submits to a ring that has mail, and cancels are not held back for a batch
+        if (m_mail.load(std::memory_order_relaxed)) return deliver(), void(io_uring_submit(&m_ring));
+        if (m_batch <= 1 || io_uring_sq_ready(&m_ring) >= m_batch) return void(io_uring_submit(&m_ring));
+        // checked against the recorded owner, binding a ring here would take the context lock under ours
+        const auto owner = m_owner.load(std::memory_order_relaxed);
+        if (owner != std::thread::id{} && owner != std::this_thread::get_id()) io_uring_submit(&m_ring);
+    }
+
+    void IoRing::flush() noexcept {
+        std::lock_guard lk{m_lock};
+        if (m_mail.load(std::memory_order_relaxed) && !foreign()) deliver();
+        if (io_uring_sq_ready(&m_ring)) io_uring_submit(&m_ring);
+    }
+
+    bool IoRing::foreign() const noexcept {
+        // only single issuer rings have a control ring
+        return m_control && m_owner.load(std::memory_order_relaxed) != std::this_thread::get_id();
+    }
+
+    void IoRing::cancel(AwaitCore *await) noexcept {
+        if (!foreign()) return issue(Cancel{await, {}});
+        std::lock_guard lk{m_mail_lock};
+        // a completed operation had its cancels withdrawn, and must not leave a new one behind
+        if (std::atomic_ref{await->m_pending}.load(std::memory_order_acquire)) post(Cancel{await, {}});
     }
 
-    bool IoRing::wait_one() {
+    void IoRing::cancel(MultiCore *core) noexcept {
+        if (!foreign()) return issue(Cancel{tag(core), {}});
+        std::lock_guard lk{m_mail_lock};
+        if (!core->done()) post(Cancel{tag(core), {}});
+    }
+
+    void IoRing::cancel(FileRef file) noexcept {
+        if (!foreign()) return issue(Cancel{nullptr, file});
+        std::lock_guard lk{m_mail_lock};
+        post(Cancel{nullptr, file});
+    }
+
+    void IoRing::prepare(io_uring_sqe *sqe, const Cancel &cancel) noexcept {
+        if (cancel.data) io_uring_prep_cancel(sqe, cancel.data, 0);
+        else {
+            const auto fixed = cancel.file.fixed ? IORING_ASYNC_CANCEL_FD_FIXED : 0;
+            io_uring_prep_cancel_fd(sqe, cancel.file.fd, IORING_ASYNC_CANCEL_ALL | fixed);
+        }
+        io_uring_sqe_set_data(sqe, nullptr);
+    }
+
+    void IoRing::issue(Cancel cancel) noexcept {
+        std::lock_guard lk{m_lock};
+        prepare(get_sqe(), cancel);
+        // skip the deferral, the target may otherwise complete and have its memory reused meanwhile
+        io_uring_submit(&m_ring);
+    }
+
+    void IoRing::post(Cancel cancel) noexcept {
+        m_mailbox.push_back(cancel);
+        m_mail.store(true, std::memory_order_relaxed);
+    }
+
+    void IoRing::deliver() noexcept {
+        std::vector<Cancel> mail{};
+        {
+            // taken out first, getting an entry may wait on the completion thread, which takes the mail lock
+            std::lock_guard lk{m_mail_lock};
+            mail.swap(m_mailbox);
+            m_mail.store(false, std::memory_order_relaxed);
+        }
+        for (const auto &cancel: mail) prepare(get_sqe(), cancel);
+    }
+
+    void IoRing::withdraw(void *data) noexcept {
+        std::lock_guard lk{m_mail_lock};
+        if (m_mailbox.empty()) return;
+        std::erase_if(m_mailbox, [data](const Cancel &cancel) noexcept { return cancel.data == data; });
+        m_mail.store(!m_mailbox.empty(), std::memory_order_relaxed);
+    }
+
+    bool IoRing::wait_batch() {
         io_uring_cqe *cqe{};
-        if (const auto ret = io_uring_wait_cqe(&m_ring, &cqe); ret == 0) {
-            static_cast<AwaitCore *>(io_uring_cqe_get_data(cqe))->release(cqe->res);
-            io_uring_cqe_seen(&m_ring, cqe);
-            return true;
-        } else return (ret != ENXIO); // break if instance shutdown
+        if (const auto ret = io_uring_wait_cqe(&m_ring, &cqe); ret != 0) return (ret != -ENXIO); // break if shutdown
+        // Copy the batch out and retire it in one head update before resuming anything,
+        //     so that the kernel gets the slots back as early as possible
+        unsigned head, count = 0;
+        io_uring_for_each_cqe(&m_ring, head, cqe) {
+            m_reaped[count] = Reaped{io_uring_cqe_get_data(cqe), cqe->res, cqe->flags};
+            if (++count == m_reaped.size()) break;
+        }
+        io_uring_cq_advance(&m_ring, count);
+        for (unsigned i = 0; i < count; ++i) {
+            const auto [data, result, flags] = m_reaped[i];
+            const auto bits = reinterpret_cast<uintptr_t>(data);
+            const auto address = bits & ~uintptr_t(3);
+            if ((bits & 3u) == 3u) {
+                const auto link = reinterpret_cast<ChainLink *>(address);
+                link->result = result;
+                link->await->release(result, flags);
+            }
+            else if (bits & 1u) {
+                const auto more = (flags & IORING_CQE_F_MORE) != 0;
+                reinterpret_cast<MultiCore *>(address)->complete(result, flags, more);
+                if (!more && m_control) withdraw(data);
+            }
+            else if (bits & 2u) {
+                reinterpret_cast<AwaitCore *>(address)->expire(result == -ETIME);
+                if (m_control) withdraw(reinterpret_cast<void *>(address));
+            }
+            else if (data) {
+                // A zero copy send completes twice, first with its result and then with a notification once
+                //     the kernel no longer reads from the buffer. Only the notification resumes the caller
+                const auto core = static_cast<AwaitCore *>(data);
+                if (flags & IORING_CQE_F_NOTIF) core->release(core->m_result, core->m_flags);
+                else if (flags & IORING_CQE_F_MORE) core->m_result = result, core->m_flags = flags;
+                else core->release(result, flags);
+                // after the completion is counted, so that a cancel posted meanwhile sees it
+                if (m_control) withdraw(data);
+            }
+        }
+        return !m_stop.load();
+    }
+
+    int IoRing::update_buffers(unsigned first, const iovec *buffers, unsigned count) noexcept {
+        return io_uring_register_buffers_update_tag(&m_ring, first, buffers, nullptr, count);
     }
 
+    int IoRing::update_files(unsigned first, const int *files, unsigned count) noexcept {
+        return io_uring_register_files_update(&m_ring, first, files, count);
+    }
+
+    void IoRing::message(IoRing &target, void *data) noexcept {
+        std::lock_guard lk{m_lock};
+        const auto sqe = get_sqe();
+        io_uring_prep_msg_ring(sqe, target.m_ring.ring_fd, 0, reinterpret_cast<uint64_t>(data), 0);
+        io_uring_sqe_set_data(sqe, nullptr);
+        io_uring_submit(&m_ring);
+    }
+
+    bool MultiCore::wait(NextAwait *awaiter) noexcept {
+        bool suspend{false}, pause{false};
+        {
+            std::lock_guard lk{m_lock};
+            pause = m_throttled && !m_done.load() && !std::exchange(m_paused, true);
+            if (!m_queue.empty()) {
+                awaiter->m_value = m_queue.front();
+                m_queue.pop_front();
+            }
+            else if (m_done.load()) awaiter->m_value = Completion{-ECANCELED, 0};
+            else m_waiter = awaiter, suspend = true;
+        }
+        // outside the lock, as the submission may have to wait for room in the ring
+        if (pause) cancel();
+        return suspend;
+    }
+
+    void MultiCore::complete(int32_t result, uint32_t flags, bool more) noexcept {
+        NextAwait *waiter{};
+        {
+            std::lock_guard lk{m_lock};
+            if (!more) m_done.store(true);
+            waiter = std::exchange(m_waiter, nullptr);
+            if (!waiter) {
+                if (!more || !m_lossy || m_queue.size() < m_capacity) m_queue.push_back(Completion{result, flags});
+                // only flagged here, the consumer submits the cancel
+                m_throttled = m_throttled || (more && m_queue.size() >= m_capacity);
+            }
+        }
+        if (waiter) waiter->release(Completion{result, flags});
+        if (!more) drop();
+    }
+
+    void RingCore::cancel() noexcept { m_ring->cancel(this); }
+
+    IoContext::IoContext(const RingConfig &config) :
+            m_config(config), m_shared(m_config),
+            m_buffers(config.fixed_buffers, iovec{}), m_files(config.fixed_files, -1) {}
+
+    IoContext &IoContext::get() noexcept { return gIoContext.value; }
+
+    IoRing *IoContext::acquire() noexcept {
+        if (!m_config.per_thread) return &m_shared;
+        std::lock_guard lk{m_lock};
+        if (!m_idle.empty()) {
+            const auto ring = m_idle.back();
+            m_idle.pop_back();
+            ring->own();
+            return ring;
+        }
+        try {
+            const auto index = static_cast<unsigned>(m_rings.size() + 1);
+            const auto ring = m_rings.emplace_back(std::make_unique<IoRing>(m_config, &m_shared, index)).get();
+            // bring the new ring up to date with everything registered so far
+            if (!m_buffers.empty()) ring->update_buffers(0, m_buffers.data(), m_buffers.size());
+            if (!m_files.empty()) ring->update_files(0, m_files.data(), m_files.size());
+            ring->own();
+            return ring;
+        }
+        catch (...) {
+            // running out of memory or locked pages only costs this thread its private ring
+            return &m_shared;
+        }
+    }
+
+    void IoContext::release(IoRing *ring) noexcept {
+        ring->flush();
+        if (ring == &m_shared || m_config.single_issuer) return;
+        std::lock_guard lk{m_lock};
+        m_idle.push_back(ring);
+    }
+
+    int IoContext::register_buffers(Span<iovec> buffers) {
+        std::lock_guard lk{m_lock};
+        const auto count = static_cast<unsigned>(buffers.size());
+        // first fit over the empty slots, pools come and go rarely enough for this not to matter
+        for (unsigned first = 0, run = 0; first + run < m_buffers.size();) {
+            if (m_buffers[first + run].iov_base) {
+                first += run + 1, run = 0;
+                continue;
+            }
+            if (++run < count) continue;
+            auto result = m_shared.update_buffers(first, buffers.data(), count);
+            for (auto &ring: m_rings) if (result >= 0) result = ring->update_buffers(first, buffers.data(), count);
+            if (result < 0) {
+                // roll back whatever rings did take the buffers so that no pages are left pinned
+                unregister_locked(first, count);
+                throw exception_errc(map_error(-result));
+            }
+            std::copy_n(buffers.data(), count, m_buffers.begin() + first);
+            return static_cast<int>(first);
+        }
+        return -1;
+    }
+
+    void IoContext::unregister_buffers(int first, unsigned count) noexcept {
+        std::lock_guard lk{m_lock};
+        unregister_locked(static_cast<unsigned>(first), count);
+    }
+
+    void IoContext::unregister_locked(unsigned first, unsigned count) noexcept {
+        const auto begin = m_buffers.begin() + first;
+        std::fill(begin, begin + count, iovec{});
+        m_shared.update_buffers(first, &*begin, count);
+        for (auto &ring: m_rings) ring->update_buffers(first, &*begin, count);
+    }
+
+    int IoContext::register_file(int fd) noexcept {
+        std::lock_guard lk{m_lock};
+        const auto it = std::find(m_files.begin(), m_files.end(), -1);
+        if (it == m_files.end()) return -ENFILE;
+        const auto slot = static_cast<unsigned>(it - m_files.begin());
+        auto result = m_shared.update_files(slot, &fd, 1);
+        for (auto &ring: m_rings) if (result >= 0) result = ring->update_files(slot, &fd, 1);
+        if (result < 0) {
+            // do not leave the file referenced by the rings that did take it
+            const int empty = -1;
+            m_shared.update_files(slot, &empty, 1);
+            for (auto &ring: m_rings) ring->update_files(slot, &empty, 1);
+            return result;
+        }
+        *it = fd;
+        return static_cast<int>(slot);
+    }
+
+    void IoContext::unregister_file(int slot) noexcept {
+        std::lock_guard lk{m_lock};
+        const auto index = static_cast<unsigned>(slot);
+        m_files[index] = -1;
+        m_shared.update_files(index, &m_files[index], 1);
+        for (auto &ring: m_rings) ring->update_files(index, &m_files[index], 1);
+    }
+
+    void IoContext::cancel(FileRef file, uint64_t rings) noexcept {
+        if (rings & m_shared.bit()) m_shared.cancel(file);
+        // the rings never take the context lock while holding their own, so they may be locked under it
+        std::lock_guard lk{m_lock};
+        for (auto &ring: m_rings) if (rings & ring->bit()) ring->cancel(file);
+    }
+
+    void cancel(AwaitCore *await) noexcept { if (const auto ring = IoRing::of(await); ring) ring->cancel(await); }
+
+    void park(IoRing *ring) noexcept { ring->park(); }
+
     SafeHandle<Uring> Uring::get() noexcept {
         static SafeHandle<Uring> instance{Uring{}};
         return instance;
     }
 
-    Uring::Uring() : Handle<IoRing *>([](auto p) noexcept { std::destroy_at(p); }, IoRing::get()) {
-        std::construct_at(value());
+    // Completions resume coroutines on the completion threads, so the last handle may be dropped on one of them.
+    // Tearing the rings down there would free the ring under the loop still running on it, so the context
+    //     goes down on a thread of its own instead, which waits for every completion thread to leave its loop
+    static void retire(IoContext *context) noexcept {
+        if (!gReaping) return std::destroy_at(context);
+        try {
+            std::thread([context]() { std::destroy_at(context); }).detach();
+        }
+        catch (...) {
+            // without a thread to tear down from, leaving the rings up is the only safe way out
+        }
+    }
+
+    Uring::Uring() : Handle<IoContext *>([](auto p) noexcept { retire(p); }, &gIoContext.value) {
+        gStarted.store(true);
+        std::construct_at(value(), gConfig);
+    }
+}
+
+namespace kls::io {
+    void configure(const RingConfig &config) {
+        if (detail::gStarted.load()) throw exception_errc(IO_EBUSY);
+        // a timed operation takes two entries at once
+        if (config.sq_entries < 2 || (config.cq_entries && config.cq_entries < config.sq_entries))
+            throw exception_errc(IO_EINVAL);
+        if (config.single_issuer && (!config.per_thread || config.fixed_buffers || config.fixed_files))
+            throw exception_errc(IO_EINVAL);
+        detail::gConfig = config;
+    }
+
+    void flush() noexcept {
+        if (detail::gStarted.load()) detail::IoRing::get()->flush();
     }
-}
\ No newline at end of file
+}
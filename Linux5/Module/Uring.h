@@ -22,37 +22,182 @@
 
 #pragma once
 
+#include <mutex>
 #include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
 #include <coroutine>
 #include <liburing.h>
 #include "kls/Handle.h"
+#include "kls/io/Ring.h"
 #include "kls/io/Await.h"
 #include "kls/thread/SpinLock.h"
 #include "kls/essential/Memory.h"
+#include "kls/coroutine/Async.h"
 
 namespace kls::io::detail {
     enum class IoOps {
-        Open, Read, Write, Sync, Close, Send, Recv, SendMsg, RecvMsg, Accept, Connect
+        Open, Read, Write, ReadFixed, WriteFixed, Sync, Close, Send, Recv, RecvMulti, SendMsg, RecvMsg, Accept, Connect,
+        SendZc, SendMsgZc, ReadV, WriteV, Fallocate, Fadvise,
+        SyncRange, Madvise, Splice
+    };
+
+    // A file descriptor, or a slot of the registered file table
+    struct FileRef {
+        int fd;
+        bool fixed;
     };
 
     class IoRing {
-        static constexpr int QUEUE_DEPTH = 8192;
     public:
-        IoRing();
+        // `index` numbers the rings of the context, the shared ring being 0
+        explicit IoRing(const RingConfig &config, IoRing *attach = nullptr, unsigned index = 0);
         ~IoRing();
+        // The ring the calling thread should submit to
         static IoRing *get() noexcept;
-        [[nodiscard]] io_uring_sqe *get_sqe() noexcept;
+        // Completes `await` on the spot without submitting anything, for requests refused before reaching the kernel
+        static void finish(AwaitCore *await, int32_t result) noexcept { await->release(result, 0); }
+        // Same for a multishot operation, which ends with `result` as its final completion
+        static void finish(MultiCore *core, int32_t result) noexcept { core->complete(result, 0, false); }
+        // The ring the operation of `await` was submitted to, if any
+        static IoRing *of(AwaitCore *await) noexcept { return await->m_ring; }
+        // Marks `await` as waiting on this ring, so that parking on it flushes the ring in deferred mode
+        void adopt(AwaitCore *await) noexcept { await->m_ring = this; }
+        void attach(io_uring_sqe *sqe, AwaitCore *await) noexcept { io_uring_sqe_set_data(sqe, await), adopt(await); }
+        // Takes a free entry once `reserve` entries are free, so that a linked chain never gets split by a submission
+        [[nodiscard]] io_uring_sqe *get_sqe(unsigned reserve = 1) noexcept;
+        // Links a timeout after the entry of `await`, taking the entry from the reservation made for the chain
+        void link_timeout(io_uring_sqe *sqe, AwaitCore *await, __kernel_timespec *limit) noexcept;
+        // Hands prepared entries to the kernel, or leaves them pending in deferred mode. Must hold the lock.
+        // Entries from threads other than the owner of a per-thread ring are submitted right away,
+        //     as only the owner flushes it. On the shared ring each thread flushes its own as it parks
+        void submit() noexcept;
+        // Makes the calling thread the owner of a per-thread ring, the shared ring has no owner
+        void own() noexcept { m_owner.store(std::this_thread::get_id(), std::memory_order_relaxed); }
+        // Submits all pending entries regardless of the mode
+        void flush() noexcept;
+        // Flushes in deferred mode or with cancels in the mailbox, called as an await on this ring parks
+        void park() noexcept { if (m_batch > 1 || m_mail.load(std::memory_order_relaxed)) flush(); }
+        // Cancels the operation of `await`, the multishot operation of `core`, or every operation on `file`.
+        // A single issuer ring only takes submissions from its owner. A cancel from another thread is left
+        //     in a mailbox instead, and goes out the next time the owner submits, parks or flushes
+        void cancel(AwaitCore *await) noexcept;
+        void cancel(MultiCore *core) noexcept;
+        void cancel(FileRef file) noexcept;
+        // Replaces `count` entries of the registered buffer table starting from `first`
+        int update_buffers(unsigned first, const iovec *buffers, unsigned count) noexcept;
+        // Same for the registered file table, -1 clears a slot
+        int update_files(unsigned first, const int *files, unsigned count) noexcept;
         [[nodiscard]] auto &ring() noexcept { return m_ring; }
         [[nodiscard]] auto &lock() noexcept { return m_lock; }
+        // Marks the ring in masks of rings, past 63 rings share the last bit
+        [[nodiscard]] uint64_t bit() const noexcept { return m_bit; }
+        // Whether the calling thread must not submit to this ring, only ever the case on a single issuer ring
+        //     it does not own. The kernel would fail such a submission as a whole with -EEXIST
+        [[nodiscard]] bool foreign() const noexcept;
     private:
+        struct Reaped {
+            void *data;
+            int32_t result;
+            uint32_t flags;
+        };
+
+        // A cancel of the operation with the user data `data`, or of every operation on `file` if it is null
+        struct Cancel {
+            void *data;
+            FileRef file;
+        };
+
         io_uring m_ring{};
-        // We need the lock as we are not able to gather wait CQEs
-        // Which made it not practical to use multiple rings to submit.
-        // Since the ring itself is not constructed with thread safe,
-        //     we need a large lock around the ring for safe submission
+        const unsigned m_batch;
+        const bool m_poll;
+        const uint64_t m_bit;
+        // With a single issuer nobody but the owner may submit to this ring,
+        //     so the wake up at shutdown is posted from the control ring instead
+        IoRing *const m_control;
+        // The submission side of the ring is not thread safe, so every submission is done under this lock.
+        // In shared mode all threads go through the same lock. In per-thread mode the lock is only ever taken
+        //     by the owning thread, apart from the rare submission targeting a specific ring, so it stays uncontended
         thread::SpinLock m_lock{};
+        std::atomic_bool m_stop{false};
+        std::atomic<std::thread::id> m_owner{};
+        std::thread m_reaper{};
+        std::vector<Reaped> m_reaped;
+        // Cancels left by other threads on a single issuer ring. The completion thread withdraws those of
+        //     operations that complete first, as their user data may be reused by the next operation
+        thread::SpinLock m_mail_lock{};
+        std::atomic_bool m_mail{false};
+        std::vector<Cancel> m_mailbox{};
+
+        bool wait_batch();
+        void message(IoRing &target, void *data) noexcept;
+        void issue(Cancel cancel) noexcept;
+        void post(Cancel cancel) noexcept;
+        void deliver() noexcept;
+        void withdraw(void *data) noexcept;
+        static void prepare(io_uring_sqe *sqe, const Cancel &cancel) noexcept;
+    };
+
+    // Owns every ring of the process. Each ring has its own completion thread,
+    //     and completed awaits are handed back to their executors through the trigger as usual.
+    // Reaping on the owning thread would save that thread and the hop, but needs the executor to poll the ring
+    //     between tasks, which kls::coroutine executors offer no hook for
+    class IoContext {
+    public:
+        explicit IoContext(const RingConfig &config);
+        [[nodiscard]] IoRing *acquire() noexcept;
+        void release(IoRing *ring) noexcept;
+        [[nodiscard]] const auto &config() const noexcept { return m_config; }
+        // Only valid while a Uring handle is held
+        static IoContext &get() noexcept;
+        // Reserves consecutive slots of the registered buffer table and registers `buffers` there with every ring.
+        // Returns the first slot, or -1 if the table has no room left
+        [[nodiscard]] int register_buffers(Span<iovec> buffers);
+        void unregister_buffers(int first, unsigned count) noexcept;
+        // Places `fd` in a free slot of the registered file table of every ring.
+        // Returns the slot, or a negated error code, -ENFILE if the table is full
+        [[nodiscard]] int register_file(int fd) noexcept;
+        void unregister_file(int slot) noexcept;
+        // Cancels every operation on `file` on the rings marked in `rings`
+        void cancel(FileRef file, uint64_t rings) noexcept;
+        // Buffer group ids for provided buffer rings
+        [[nodiscard]] uint16_t allocate_group() noexcept { return m_groups.fetch_add(1); }
+    private:
+        const RingConfig m_config;
+        IoRing m_shared;
+        std::vector<iovec> m_buffers;
+        std::vector<int> m_files;
+        std::atomic<uint16_t> m_groups{0};
+        std::mutex m_lock{};
+        std::vector<std::unique_ptr<IoRing>> m_rings{};
+        std::vector<IoRing *> m_idle{};
 
-        bool wait_one();
+        void unregister_locked(unsigned first, unsigned count) noexcept;
+    };
+
+    // Completions of multishot operations are told apart from plain awaits by the low bit of their user data
+    inline void *tag(MultiCore *core) noexcept {
+        return reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(core) | 1u);
+    }
+
+    // Linked timeouts of plain awaits are marked with the second bit
+    inline void *expiry(AwaitCore *core) noexcept {
+        return reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(core) | 2u);
+    }
+
+    // and operations of a chain with both
+    inline void *tag(ChainLink *link) noexcept {
+        return reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(link) | 3u);
+    }
+
+    // A multishot operation living on a given ring
+    class RingCore : public MultiCore {
+    public:
+        explicit RingCore(IoRing *ring) noexcept: m_ring(ring) {}
+        void cancel() noexcept override;
+    protected:
+        IoRing *const m_ring;
     };
 
     template<IoOps Op, class ...Args>
@@ -60,50 +205,125 @@ namespace kls::io::detail {
         if constexpr(Op == IoOps::Open) io_uring_prep_openat(sqe, std::forward<Args>(args)...);
         else if constexpr(Op == IoOps::Read) io_uring_prep_read(sqe, std::forward<Args>(args)...);
         else if constexpr(Op == IoOps::Write) io_uring_prep_write(sqe, std::forward<Args>(args)...);
+        else if constexpr(Op == IoOps::ReadFixed) io_uring_prep_read_fixed(sqe, std::forward<Args>(args)...);
+        else if constexpr(Op == IoOps::WriteFixed) io_uring_prep_write_fixed(sqe, std::forward<Args>(args)...);
         else if constexpr(Op == IoOps::Sync) io_uring_prep_fsync(sqe, std::forward<Args>(args)...);
         else if constexpr(Op == IoOps::Close) io_uring_prep_close(sqe, std::forward<Args>(args)...);
         else if constexpr(Op == IoOps::Send) io_uring_prep_send(sqe, std::forward<Args>(args)...);
         else if constexpr(Op == IoOps::Recv) io_uring_prep_recv(sqe, std::forward<Args>(args)...);
+        else if constexpr(Op == IoOps::RecvMulti) io_uring_prep_recv_multishot(sqe, std::forward<Args>(args)...);
         else if constexpr(Op == IoOps::SendMsg) io_uring_prep_sendmsg(sqe, std::forward<Args>(args)...);
         else if constexpr(Op == IoOps::RecvMsg) io_uring_prep_recvmsg(sqe, std::forward<Args>(args)...);
         else if constexpr(Op == IoOps::Accept) io_uring_prep_accept(sqe, std::forward<Args>(args)...);
         else if constexpr(Op == IoOps::Connect) io_uring_prep_connect(sqe, std::forward<Args>(args)...);
+        else if constexpr(Op == IoOps::SendZc) io_uring_prep_send_zc(sqe, std::forward<Args>(args)...);
+        else if constexpr(Op == IoOps::ReadV) io_uring_prep_readv(sqe, std::forward<Args>(args)...);
+        else if constexpr(Op == IoOps::WriteV) io_uring_prep_writev(sqe, std::forward<Args>(args)...);
+        else if constexpr(Op == IoOps::Fallocate) io_uring_prep_fallocate(sqe, std::forward<Args>(args)...);
+        else if constexpr(Op == IoOps::Fadvise) io_uring_prep_fadvise(sqe, std::forward<Args>(args)...);
+        else if constexpr(Op == IoOps::SyncRange) io_uring_prep_sync_file_range(sqe, std::forward<Args>(args)...);
+        else if constexpr(Op == IoOps::Madvise) io_uring_prep_madvise(sqe, std::forward<Args>(args)...);
+        else if constexpr(Op == IoOps::Splice) io_uring_prep_splice(sqe, std::forward<Args>(args)...);
+    }
+
+    template<IoOps Op, class ...Args>
+    void io_pack_args(io_uring_sqe *sqe, FileRef file, Args &&... args) noexcept {
+        io_pack_args<Op>(sqe, file.fd, std::forward<Args>(args)...);
+        if (file.fixed) sqe->flags |= IOSQE_FIXED_FILE;
     }
 
     template<IoOps Op>
-    void io_vec_pack_args(io_uring_sqe *sqe, int fd, msghdr *msg, unsigned flags) noexcept {
-        if constexpr(Op == IoOps::SendMsg) io_uring_prep_sendmsg(sqe, fd, msg, flags);
-        else if constexpr(Op == IoOps::RecvMsg) io_uring_prep_recvmsg(sqe, fd, msg, flags);
+    void io_vec_pack_args(io_uring_sqe *sqe, FileRef file, msghdr *msg, unsigned flags) noexcept {
+        if constexpr(Op == IoOps::SendMsg) io_uring_prep_sendmsg(sqe, file.fd, msg, flags);
+        else if constexpr(Op == IoOps::RecvMsg) io_uring_prep_recvmsg(sqe, file.fd, msg, flags);
+        else if constexpr(Op == IoOps::SendMsgZc) io_uring_prep_sendmsg_zc(sqe, file.fd, msg, flags);
+        if (file.fixed) sqe->flags |= IOSQE_FIXED_FILE;
     }
 
     template<class Ret, IoOps Op, class ...Args>
     IOAwait<Ret> io_plain(Args &&... args) noexcept {
-        std::lock_guard lk{IoRing::get()->lock()};
+        const auto value = IoRing::get();
+        std::lock_guard lk{value->lock()};
         return IOAwait<Ret>{
-                [&, value = IoRing::get()](IOAwait<Ret> *ths) noexcept {
+                [&](IOAwait<Ret> *ths) noexcept {
                     const auto sqe = value->get_sqe();
                     io_pack_args<Op>(sqe, std::forward<Args>(args)...);
-                    io_uring_sqe_set_data(sqe, ths);
-                    io_uring_submit(&value->ring());
+                    value->attach(sqe, ths);
+                    value->submit();
+                }
+        };
+    }
+
+    template<class Ret, IoOps Op, class ...Args>
+    TimedAwait<IOAwait<Ret>> io_timed(std::chrono::nanoseconds limit, Args &&... args) noexcept {
+        const auto value = IoRing::get();
+        std::lock_guard lk{value->lock()};
+        return TimedAwait<IOAwait<Ret>>{
+                limit, [&](IOAwait<Ret> *ths, __kernel_timespec *spec) noexcept {
+                    const auto sqe = value->get_sqe(2);
+                    io_pack_args<Op>(sqe, std::forward<Args>(args)...);
+                    value->attach(sqe, ths);
+                    value->link_timeout(sqe, ths, spec);
+                    value->submit();
                 }
         };
     }
 
+    // An await completed on the spot with `result`, for requests settled without going through the ring
+    template<class Ret>
+    IOAwait<Ret> io_immediate(int32_t result) noexcept {
+        return IOAwait<Ret>{[result](IOAwait<Ret> *ths) noexcept { IoRing::finish(ths, result); }};
+    }
+
+    // Prepares and submits one entry on a given ring, for operations bound to resources of that ring.
+    // Always submitted right away, as nothing parks on these entries to flush them in deferred mode
+    template<class Fn>
+    void io_submit_on(IoRing *ring, Fn &&fn) noexcept {
+        std::lock_guard lk{ring->lock()};
+        const auto sqe = ring->get_sqe();
+        fn(sqe);
+        io_uring_submit(&ring->ring());
+    }
+
     template<IoOps Op>
-    VecAwait io_message(int fd, const msghdr &msg, unsigned flags) noexcept {
-        std::lock_guard lk{IoRing::get()->lock()};
+    VecAwait io_message(FileRef fd, const msghdr &msg, unsigned flags) noexcept {
+        const auto value = IoRing::get();
+        std::lock_guard lk{value->lock()};
         return VecAwait{
-                [&, value = IoRing::get()](VecAwait *ths, msghdr *m) noexcept {
+                [&](VecAwait *ths, msghdr *m) noexcept {
                     *m = msg;
                     const auto sqe = value->get_sqe();
                     io_vec_pack_args<Op>(sqe, fd, m, flags);
-                    io_uring_sqe_set_data(sqe, ths);
-                    io_uring_submit(&value->ring());
+                    value->attach(sqe, ths);
+                    value->submit();
+                }
+        };
+    }
+
+    template<IoOps Op>
+    TimedAwait<VecAwait> io_message_timed(
+            std::chrono::nanoseconds limit, FileRef fd, const msghdr &msg, unsigned flags
+    ) noexcept {
+        const auto value = IoRing::get();
+        std::lock_guard lk{value->lock()};
+        return TimedAwait<VecAwait>{
+                limit, [&](VecAwait *ths, msghdr *m, __kernel_timespec *spec) noexcept {
+                    *m = msg;
+                    const auto sqe = value->get_sqe(2);
+                    io_vec_pack_args<Op>(sqe, fd, m, flags);
+                    value->attach(sqe, ths);
+                    value->link_timeout(sqe, ths, spec);
+                    value->submit();
                 }
         };
     }
 
-    struct Uring : Handle<IoRing *> {
+    // Moves `length` bytes from `in` at `offset` to `out` through a pipe, without the data passing through
+    //     user space. `at` is the offset to write `out` at, or -1 for sockets and pipes.
+    // Fails with IO_EIO if `in` ends first
+    coroutine::ValueAsync<Status> splice_through(int in, uint64_t offset, int out, int64_t at, uint64_t length);
+
+    struct Uring : Handle<IoContext *> {
         static SafeHandle<Uring> get() noexcept;
     private:
         Uring();
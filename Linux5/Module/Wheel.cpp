@@ -0,0 +1,112 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <algorithm>
+#include "kls/io/Wheel.h"
+#include "kls/io/Timer.h"
+
+namespace {
+    using kls::io::detail::WheelNode;
+
+    // Moves every node of `slot` over to the empty list `list`
+    void take(WheelNode &slot, WheelNode &list) noexcept {
+        if (slot.next == &slot) {
+            list.prev = list.next = &list;
+            return;
+        }
+        list.next = slot.next, list.prev = slot.prev;
+        list.next->prev = list.prev->next = &list;
+        slot.prev = slot.next = &slot;
+    }
+}
+
+namespace kls::io {
+    TimerWheel::TimerWheel(std::chrono::nanoseconds resolution) noexcept:
+            m_resolution(resolution), m_start(std::chrono::steady_clock::now()) {
+        for (auto &level: m_levels) for (auto &slot: level) slot.prev = slot.next = &slot;
+    }
+
+    TimerWheel::~TimerWheel() noexcept {
+        // leave the entries disarmed, so that they do not reach back in here when destroyed
+        for (auto &level: m_levels) for (auto &slot: level) while (slot.next != &slot) slot.next->unlink();
+    }
+
+    void TimerWheel::arm(WheelEntry &entry, std::chrono::nanoseconds delay) noexcept {
+        static constexpr uint64_t max_ticks = (uint64_t(1) << (slot_bits * level_count)) - 1;
+        const auto ticks = std::max<int64_t>(0, (delay.count() + m_resolution.count() - 1) / m_resolution.count());
+        entry.unlink();
+        entry.m_expiry = m_now + std::min(static_cast<uint64_t>(ticks), max_ticks);
+        insert(entry);
+    }
+
+    void TimerWheel::insert(WheelEntry &entry) noexcept {
+        // the lowest level whose lap covers the remaining ticks
+        const auto delta = entry.m_expiry - m_now;
+        unsigned level = 0;
+        while (level + 1 < level_count && delta >> (slot_bits * (level + 1))) ++level;
+        auto &slot = m_levels[level][(entry.m_expiry >> (slot_bits * level)) & (slot_count - 1)];
+        WheelNode &node = entry;
+        node.prev = slot.prev, node.next = &slot;
+        slot.prev->next = &node, slot.prev = &node;
+    }
+
+    void TimerWheel::advance(std::chrono::steady_clock::time_point now) noexcept {
+        if (now < m_start) return;
+        const auto due = static_cast<uint64_t>((now - m_start) / m_resolution);
+        while (m_now <= due) tick();
+    }
+
+    void TimerWheel::tick() noexcept {
+        const auto index = m_now & (slot_count - 1);
+        // at the start of every lap, the current slot of the level above is spread over the levels below
+        if (index == 0) {
+            for (unsigned level = 1; level < level_count; ++level) {
+                const auto slot = (m_now >> (slot_bits * level)) & (slot_count - 1);
+                WheelNode list{};
+                take(m_levels[level][slot], list);
+                while (list.next != &list) {
+                    auto &entry = static_cast<WheelEntry &>(*list.next);
+                    entry.unlink();
+                    insert(entry);
+                }
+                if (slot != 0) break;
+            }
+        }
+        // detach the due entries first, anything armed from expired() lands in a later tick
+        WheelNode due{};
+        take(m_levels[0][index], due);
+        ++m_now;
+        while (due.next != &due) {
+            auto &entry = static_cast<WheelEntry &>(*due.next);
+            entry.unlink();
+            entry.expired();
+        }
+    }
+
+    coroutine::ValueAsync<void> TimerWheel::run() {
+        const auto ticks = timer(m_resolution);
+        while (!m_stopped) {
+            if (const auto status = co_await ticks->next(); status != IO_OK) throw exception_errc(status);
+            advance(std::chrono::steady_clock::now());
+        }
+    }
+}
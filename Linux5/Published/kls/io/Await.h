@@ -22,11 +22,22 @@
 
 #pragma once
 
+#include <array>
+#include <deque>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <limits>
 #include <utility>
+#include <optional>
 #include <concepts>
+#include <stop_token>
+#include <sys/uio.h>
 #include <sys/socket.h>
+#include <linux/time_types.h>
+#include "kls/Span.h"
 #include "kls/io/Status.h"
+#include "kls/thread/SpinLock.h"
 #include "kls/coroutine/Trigger.h"
 
 namespace kls::io::detail {
@@ -34,6 +45,8 @@ namespace kls::io::detail {
 
 	Status map_error(int32_t sys) noexcept;
     IOResult map_result(int32_t sys) noexcept;
+    // Hands the entries left pending on `ring` in deferred mode to the kernel before a coroutine parks on them
+    void park(IoRing *ring) noexcept;
 
     struct AwaitCore: private coroutine::SingleExecutorTrigger, private coroutine::ExecutorAwaitEntry {
         AwaitCore() noexcept = default;
@@ -42,18 +55,132 @@ namespace kls::io::detail {
 
         bool await_suspend(std::coroutine_handle<> h) {
             ExecutorAwaitEntry::set_handle(h);
+            if (m_ring) park(m_ring);
             return SingleExecutorTrigger::trap(*this);
         }
     private:
+        // the ring the operation went to, null for awaits settled without one
+        IoRing *m_ring{};
         int32_t m_result{};
-        void release(int32_t status) { m_result = status, SingleExecutorTrigger::pull(); }
+        uint32_t m_flags{};
+        // completions still to arrive before resuming, a linked timeout adds its own.
+        // Counted down by the completion thread and read by cancels from other threads through atomic_ref
+        alignas(std::atomic_ref<uint32_t>::required_alignment) uint32_t m_pending{1};
+        bool m_expired{false};
+
+        void release(int32_t status, uint32_t flags) {
+            m_result = status, m_flags = flags;
+            if (std::atomic_ref{m_pending}.fetch_sub(1, std::memory_order_acq_rel) == 1) SingleExecutorTrigger::pull();
+        }
+
+        void expire(bool fired) {
+            m_expired = fired;
+            if (std::atomic_ref{m_pending}.fetch_sub(1, std::memory_order_acq_rel) == 1) SingleExecutorTrigger::pull();
+        }
+
         friend class detail::IoRing;
     protected:
-        [[nodiscard]] auto get_result() const noexcept { return m_result; }
+        // An operation cut off by its linked timeout completes as cancelled, report it as timed out instead
+        [[nodiscard]] auto get_result() const noexcept {
+            return (m_expired && m_result == -ECANCELED) ? -ETIMEDOUT : m_result;
+        }
+        [[nodiscard]] auto get_flags() const noexcept { return m_flags; }
+        // Waits for `count` completions before resuming, must be called before submitting
+        void expect(uint32_t count) noexcept { m_pending = count; }
+    };
+
+    // One operation of a chain, its completion is kept here and counted towards the await of the chain
+    struct ChainLink {
+        AwaitCore *await;
+        int32_t result;
+    };
+
+    // Asks the kernel to cancel the operation of `await` on the ring it went to, it then completes with IO_ECANCELED
+    void cancel(AwaitCore *await) noexcept;
+
+    // Awaits of several operations, which are submitted under their links rather than under the await.
+    // A cancel by the await finds none of them, so these cannot be cancelled
+    template <class Await>
+    concept Linked = requires { requires Await::linked; };
+
+    // Collects the completions of a multishot operation until the final one arrives.
+    // Owned jointly by the consumer and the pending operation, whichever lets go last frees it
+    class MultiCore {
+    public:
+        struct Completion {
+            int32_t result;
+            uint32_t flags;
+        };
+
+        class NextAwait : private coroutine::SingleExecutorTrigger, private coroutine::ExecutorAwaitEntry {
+        public:
+            explicit NextAwait(MultiCore &core) noexcept: m_core(core) {}
+
+            [[nodiscard]] constexpr bool await_ready() const noexcept { return false; }
+
+            bool await_suspend(std::coroutine_handle<> h) {
+                ExecutorAwaitEntry::set_handle(h);
+                return m_core.wait(this) && SingleExecutorTrigger::trap(*this);
+            }
+
+            [[nodiscard]] Completion await_resume() const noexcept { return m_value; }
+        private:
+            MultiCore &m_core;
+            Completion m_value{};
+
+            void release(Completion value) { m_value = value, SingleExecutorTrigger::pull(); }
+            friend class MultiCore;
+        };
+
+        MultiCore() noexcept = default;
+        virtual ~MultiCore() noexcept = default;
+
+        // Resumes with the next completion. Once the final one has been consumed, resumes with -ECANCELED
+        [[nodiscard]] NextAwait next() noexcept { return NextAwait{*this}; }
+        // Asks the kernel to stop the operation, the final completion follows
+        virtual void cancel() noexcept = 0;
+        [[nodiscard]] bool done() const noexcept { return m_done.load(); }
+        // Whether the queue reached its capacity. The operation is then cancelled by the next call to next(),
+        //     as the completion thread must not submit to a ring that may be waiting on it for room
+        [[nodiscard]] bool throttled() const noexcept { return m_throttled; }
+        void drop() noexcept { if (m_refs.fetch_sub(1) == 1) delete this; }
+    protected:
+        std::deque<Completion> m_queue{};
+        size_t m_capacity{std::numeric_limits<size_t>::max()};
+        // Completions past the capacity carry nothing that needs releasing, so they are dropped instead of
+        //     queued until the consumer comes back to pause the operation
+        bool m_lossy{false};
+    private:
+        thread::SpinLock m_lock{};
+        NextAwait *m_waiter{};
+        bool m_throttled{false};
+        bool m_paused{false};
+        std::atomic_bool m_done{false};
+        std::atomic_int m_refs{2};
+
+        bool wait(NextAwait *awaiter) noexcept;
+        void complete(int32_t result, uint32_t flags, bool more) noexcept;
+        friend class detail::IoRing;
+    };
+
+    // Storage for the limit of a linked timeout, the kernel may read it any time before the operation completes
+    class TimeoutSpec {
+    public:
+        explicit TimeoutSpec(std::chrono::nanoseconds limit) noexcept:
+                m_spec{.tv_sec = limit.count() / 1000000000, .tv_nsec = limit.count() % 1000000000} {}
+        [[nodiscard]] __kernel_timespec *spec() noexcept { return &m_spec; }
+    private:
+        __kernel_timespec m_spec;
     };
 }
 
 namespace kls::io {
+    struct IoVec : private iovec {
+        constexpr IoVec() noexcept = default;
+        IoVec(Span<> span) noexcept: IoVec(span.data(), span.size()) {}
+        IoVec(void* data, size_t size) noexcept: iovec{data, size} {}
+    };
+
     template <class T>
     struct IOAwait : detail::AwaitCore {
         template <class Fn> requires std::is_invocable_v<Fn, IOAwait*>
@@ -74,4 +201,96 @@ namespace kls::io {
     private:
         msghdr m_message {};
     };
+
+    // An operation described for chain() instead of being submitted right away
+    struct LinkedOp {
+        // Refused stands for an operation its builder turned down, e.g. a misaligned one on a direct I/O file
+        enum Kind : uint8_t { Read, Write, ReadV, WriteV, ReadFixed, WriteFixed, Sync, SyncAll, Send, Recv, Refused };
+        Kind kind;
+        int fd;
+        bool fixed_file;
+        uint16_t buffer;
+        void *data;
+        // wider than the kernel takes, so that spans of 4 GiB or more are refused rather than cut short
+        uint64_t size;
+        uint64_t offset;
+    };
+
+    namespace detail {
+        void submit_chain(ChainLink *links, const LinkedOp *ops, size_t count, bool hard) noexcept;
+    }
+
+    // Operations submitted together, each starting once the one before it has succeeded.
+    // After a failure, including a short read or write, the rest complete with IO_ECANCELED unless the chain
+    //     is hard, in which case they run regardless. Resumes once with the results of all of them.
+    // A chain longer than the submission queue, or with an operation on 4 GiB or more or one its builder refused,
+    //     is refused as a whole and every operation completes with IO_EINVAL
+    template <size_t N> requires (N > 0 && N < 256)
+    struct ChainAwait : detail::AwaitCore {
+        static constexpr bool linked = true;
+
+        ChainAwait(const std::array<LinkedOp, N> &ops, bool hard) noexcept: AwaitCore() {
+            for (auto &link: m_links) link.await = this;
+            expect(N);
+            detail::submit_chain(m_links.data(), ops.data(), N, hard);
+        }
+
+        [[nodiscard]] std::array<IOResult, N> await_resume() const noexcept {
+            return [this]<size_t ...I>(std::index_sequence<I...>) {
+                return std::array<IOResult, N>{detail::map_result(m_links[I].result)...};
+            }(std::make_index_sequence<N>{});
+        }
+    private:
+        std::array<detail::ChainLink, N> m_links{};
+    };
+
+    template <class ...Ops> requires (std::same_as<Ops, LinkedOp> && ...)
+    ChainAwait<sizeof...(Ops)> chain(Ops... ops) noexcept { return {{ops...}, false}; }
+
+    template <class ...Ops> requires (std::same_as<Ops, LinkedOp> && ...)
+    ChainAwait<sizeof...(Ops)> hard_chain(Ops... ops) noexcept { return {{ops...}, true}; }
+
+    // Awaits `await`, cancelling it with IO_ECANCELED once a stop is requested on the token.
+    // Only for awaits of a single operation, chains and batches are refused
+    template <class Await> requires std::derived_from<Await, detail::AwaitCore> && (!detail::Linked<Await>)
+    class StopAwait {
+    public:
+        StopAwait(Await &await, std::stop_token token) noexcept: m_await(await), m_token(std::move(token)) {}
+
+        [[nodiscard]] constexpr bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> h) {
+            // armed before suspending, as the operation may complete and resume us right after
+            m_stop.emplace(m_token, Cancel{&m_await});
+            return m_await.await_suspend(h);
+        }
+
+        [[nodiscard]] auto await_resume() {
+            m_stop.reset(); // waits for a cancel running on another thread, as it still refers to the operation
+            return m_await.await_resume();
+        }
+    private:
+        struct Cancel {
+            detail::AwaitCore *await;
+            void operator()() const noexcept { detail::cancel(await); }
+        };
+
+        Await &m_await;
+        std::stop_token m_token;
+        std::optional<std::stop_callback<Cancel>> m_stop{};
+    };
+
+    template <class Await> requires std::derived_from<std::remove_cvref_t<Await>, detail::AwaitCore> &&
+                                    (!detail::Linked<std::remove_cvref_t<Await>>)
+    StopAwait<std::remove_cvref_t<Await>> cancellable(Await &&await, std::stop_token token) noexcept {
+        return {await, std::move(token)};
+    }
+
+    // An operation that completes with IO_ETIMEDOUT unless it finishes within the given time
+    template <class Await>
+    struct TimedAwait : private detail::TimeoutSpec, Await {
+        template <class Fn>
+        TimedAwait(std::chrono::nanoseconds limit, Fn&& fn) noexcept: TimeoutSpec(limit),
+            Await([this, &fn](auto*... args) noexcept { fn(args..., static_cast<TimeoutSpec*>(this)->spec()); }) {}
+    };
 }
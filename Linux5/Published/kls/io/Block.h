@@ -22,14 +22,78 @@
 
 #pragma once
 
+#include <vector>
 #include <cstdint>
 #include <string_view>
 #include "Await.h"
+#include "Buffer.h"
 #include "kls/Handle.h"
 #include "kls/coroutine/Async.h"
 #include "kls/essential/Memory.h"
 
 namespace kls::io {
+    struct ReadRequest {
+        Span<> buffer;
+        uint64_t offset;
+        // filled in once the batch completes
+        IOResult result{IO_OK, 0};
+    };
+
+    // Resumes once every request of a batch has completed, with the first error among them or IO_OK
+    struct BatchAwait : detail::AwaitCore {
+        static constexpr bool linked = true;
+
+        template <class Fn> requires std::is_invocable_v<Fn, detail::ChainLink*>
+        BatchAwait(Span<ReadRequest> requests, Fn&& fn): AwaitCore(), m_requests(requests), m_links(requests.size()) {
+            if (m_links.empty()) return;
+            for (auto &link: m_links) link.await = this;
+            expect(static_cast<uint32_t>(m_links.size()));
+            fn(m_links.data());
+        }
+
+        [[nodiscard]] bool await_ready() const noexcept { return m_links.empty(); }
+
+        Status await_resume() const noexcept {
+            auto status = IO_OK;
+            for (size_t i = 0; i < m_links.size(); ++i) {
+                const auto result = detail::map_result(m_links[i].result);
+                if (status == IO_OK && !result.success()) status = result.error();
+                m_requests.data()[i].result = result;
+            }
+            return status;
+        }
+    private:
+        Span<ReadRequest> m_requests;
+        std::vector<detail::ChainLink> m_links;
+    };
+
+    // A read only view of a range of a file mapped into memory, unmapped when destroyed.
+    // The view stays valid after the file is closed, but truncating the file under it faults on access
+    class MappedView {
+    public:
+        MappedView() noexcept = default;
+        MappedView(MappedView &&other) noexcept;
+        MappedView &operator=(MappedView &&other) noexcept;
+        ~MappedView() noexcept;
+        [[nodiscard]] const std::byte *data() const noexcept { return m_data; }
+        [[nodiscard]] size_t size() const noexcept { return m_size; }
+        // Writing through the span faults
+        [[nodiscard]] Span<> span() const noexcept { return Span<>(m_data, m_size); }
+        [[nodiscard]] explicit operator bool() const noexcept { return m_base; }
+        // Faults the pages of the view in ahead of use. The kernel does the work off the calling thread,
+        //     falling back to starting readahead on kernels without MADV_POPULATE_READ
+        [[nodiscard]] coroutine::ValueAsync<Status> prefault() const;
+    private:
+        void *m_base{};
+        size_t m_length{};
+        std::byte *m_data{};
+        size_t m_size{};
+
+        friend struct Block;
+        MappedView(void *base, size_t length, std::byte *data, size_t size) noexcept:
+                m_base(base), m_length(length), m_data(data), m_size(size) {}
+    };
+
 	struct Block: Handle<int> {
         enum Flag {
             F_READ = 1ul,
@@ -37,15 +101,113 @@ namespace kls::io {
             F_CREAT = 4ul,
             F_EXCL = 8ul,
             F_TRUNC = 16ul,
-            F_EXLOCK = 32ul
+            F_EXLOCK = 32ul,
+            // Bypasses the page cache. Buffers, sizes and offsets must then be multiples of alignment(),
+            //     operations on anything else fail with IO_EINVAL
+            F_DIRECT = 64ul,
+            // Writes complete only once their data is on stable storage
+            F_DSYNC = 128ul,
+            F_NOATIME = 256ul
+        };
+
+        enum Allocation {
+            // Leaves the file size alone when allocating past the end
+            A_KEEP_SIZE = 1ul,
+            // Deallocates the range, which then reads as zeros. Implies A_KEEP_SIZE
+            A_PUNCH_HOLE = 2ul,
+            // Turns the range into allocated zeros without writing them
+            A_ZERO_RANGE = 4ul
+        };
+
+        enum SyncRange {
+            // Waits for writeback of the range already in flight
+            SR_WAIT_BEFORE = 1ul,
+            // Starts writeback of the dirty pages of the range
+            SR_WRITE = 2ul,
+            // Waits for the writeback to finish
+            SR_WAIT_AFTER = 4ul
+        };
+
+        enum Advice {
+            ADVICE_NORMAL,
+            ADVICE_SEQUENTIAL,
+            ADVICE_RANDOM,
+            ADVICE_WILLNEED,
+            ADVICE_DONTNEED,
+            ADVICE_NOREUSE
+        };
+
+        enum Mapping {
+            // Reads the whole range into the page cache and maps it before map() returns
+            M_POPULATE = 1ul,
+            // Backs the view with transparent huge pages where the file system supports it
+            M_HUGEPAGE = 2ul,
+            // Reads ahead aggressively and drops pages soon after they are accessed
+            M_SEQUENTIAL = 4ul,
+            // Disables readahead
+            M_RANDOM = 8ul
         };
 
         static coroutine::ValueAsync<SafeHandle<Block>> open(std::string_view path, uint32_t flags);
+        // What buffers, sizes and offsets have to be multiples of, the logical block size of the device under F_DIRECT
+        [[nodiscard]] uint32_t alignment() const noexcept { return m_align; }
+        // A buffer suitable for I/O on this file, its size rounded up to the alignment
+        [[nodiscard]] AlignedBuffer aligned_buffer(size_t size) const;
 		IOAwait<IOResult> read(Span<> span, uint64_t offset) noexcept;
 		IOAwait<IOResult> write(Span<> span, uint64_t offset) noexcept;
+        // Same as read/write, on a buffer of a FixedBufferPool
+        IOAwait<IOResult> read_fixed(FixedBuffer buffer, uint64_t offset) noexcept;
+        IOAwait<IOResult> write_fixed(FixedBuffer buffer, uint64_t offset) noexcept;
+        // Scatters into or gathers from the buffers of `vec` as one operation starting at `offset`.
+        // `vec` has to stay alive until the operation completes
+        IOAwait<IOResult> readv(Span<IoVec> vec, uint64_t offset) noexcept;
+        IOAwait<IOResult> writev(Span<IoVec> vec, uint64_t offset) noexcept;
+        // Flushes the data of the file along with the metadata needed to read it back, like fdatasync
         IOAwait<Status> sync() noexcept;
+        // Flushes all metadata as well, like fsync
+        IOAwait<Status> sync_all() noexcept;
+        // Writes back the dirty pages of a range without flushing any metadata or the disk cache, so it only
+        //     makes overwrites of allocated blocks durable. A length of 4 GiB or more covers the rest of the file
+        IOAwait<Status> sync_range(
+                uint64_t offset, uint64_t length, uint32_t flags = SR_WAIT_BEFORE | SR_WRITE | SR_WAIT_AFTER
+        ) noexcept;
+        // Allocates the blocks of a range up front, or deallocates or zeros them according to `mode`
+        IOAwait<Status> allocate(uint64_t offset, uint64_t length, uint32_t mode = 0) noexcept;
+        // Tells the kernel how a range is going to be accessed
+        IOAwait<Status> advise(uint64_t offset, uint64_t length, Advice advice) noexcept;
+        IOAwait<Status> truncate(uint64_t length) noexcept;
+        // Maps `length` bytes from `offset` for reading, a length of 0 maps up to the end of the file.
+        // The file has to be opened with F_READ. Throws exception_errc on failure
+        [[nodiscard]] MappedView map(uint64_t offset, size_t length = 0, uint32_t flags = 0);
+        // Copies `length` bytes of `source` from offset `from` into this file at `to` with copy_file_range,
+        //     which shares the extents instead on file systems that support reflinks.
+        // Falls back to splicing through a pipe where copy_file_range is not supported between the two files.
+        // Fails with IO_EIO if `source` ends first
+        coroutine::ValueAsync<Status> copy_from(Block &source, uint64_t from, uint64_t to, uint64_t length);
+        // Reads every request in one submission. `requests` has to stay alive until the batch completes.
+        // A request on a buffer of 4 GiB or more completes with IO_EINVAL, the others still go ahead
+        BatchAwait read_batch(Span<ReadRequest> requests);
+        // The same operations described for chain(), e.g. co_await chain(file.write_op(data, at), file.sync_op()).
+        // A misaligned operation is refused along with the whole chain it goes in
+        LinkedOp read_op(Span<> span, uint64_t offset) noexcept;
+        LinkedOp write_op(Span<> span, uint64_t offset) noexcept;
+        LinkedOp readv_op(Span<IoVec> vec, uint64_t offset) noexcept;
+        LinkedOp writev_op(Span<IoVec> vec, uint64_t offset) noexcept;
+        LinkedOp read_fixed_op(FixedBuffer buffer, uint64_t offset) noexcept;
+        LinkedOp write_fixed_op(FixedBuffer buffer, uint64_t offset) noexcept;
+        LinkedOp sync_op() noexcept;
+        LinkedOp sync_all_op() noexcept;
         IOAwait<Status> close() noexcept;
+        // Places the file in the registered file table of the rings, so that operations on it skip
+        //     taking a reference to the file every time. close() gives the slot back
+        Status register_file() noexcept;
     private:
+        int m_slot{-1};
+        uint32_t m_align{1};
         explicit Block(int h);
+        [[nodiscard]] bool aligned(const void *data, size_t size, uint64_t offset) const noexcept {
+            return !((reinterpret_cast<uintptr_t>(data) | size | offset) & (m_align - 1));
+        }
+        [[nodiscard]] bool aligned(Span<IoVec> vec, uint64_t offset) const noexcept;
 	};
 }
@@ -0,0 +1,114 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <cstdint>
+#include <optional>
+#include "Await.h"
+#include "kls/Span.h"
+#include "kls/essential/Memory.h"
+
+namespace kls::io {
+    // A buffer registered with the rings. `span` may be narrowed to any range inside the registered buffer
+    struct FixedBuffer {
+        Span<> span;
+        uint16_t index;
+    };
+
+    // A set of equally sized buffers registered with every ring, so that I/O on them does not have to pin
+    //     and map the user pages on every operation. Buffers must be released back before the pool is destroyed
+    struct FixedBufferPool : PmrBase {
+        [[nodiscard]] virtual std::optional<FixedBuffer> acquire() noexcept = 0;
+        virtual void release(FixedBuffer buffer) noexcept = 0;
+    };
+
+    // Takes `count` slots out of RingConfig::fixed_buffers, throws exception_errc(IO_ENOBUFS) if there are not enough
+    std::unique_ptr<FixedBufferPool> fixed_buffer_pool(size_t count, size_t size);
+
+    // Memory aligned for direct I/O, with its size rounded up to a multiple of the alignment
+    class AlignedBuffer {
+    public:
+        AlignedBuffer(size_t size, size_t alignment);
+        AlignedBuffer(AlignedBuffer &&other) noexcept: m_data(std::exchange(other.m_data, nullptr)), m_size(other.m_size) {}
+        AlignedBuffer &operator=(AlignedBuffer &&other) noexcept;
+        ~AlignedBuffer() noexcept;
+        [[nodiscard]] std::byte *data() const noexcept { return m_data; }
+        [[nodiscard]] size_t size() const noexcept { return m_size; }
+        [[nodiscard]] Span<> span() const noexcept { return Span<>(m_data, m_size); }
+    private:
+        std::byte *m_data;
+        size_t m_size;
+    };
+
+    // A group of equally sized buffers handed to the kernel up front. Receives on it let the kernel pick a buffer
+    //     when data actually arrives, so idle connections do not have to park a buffer each.
+    // The group lives on the ring of the thread that created it, and all receives on it are submitted there.
+    // A single issuer ring takes no submissions from other threads, receives from those fail with IO_EEXIST
+    struct BufferRing : PmrBase {
+        // A buffer picked by the kernel, handed back to the ring when the lease is reset or destroyed
+        class Lease {
+        public:
+            Lease() noexcept = default;
+            Lease(Lease &&other) noexcept;
+            Lease &operator=(Lease &&other) noexcept;
+            ~Lease() noexcept { reset(); }
+            [[nodiscard]] Span<> data() const noexcept { return Span<>(m_data, m_size); }
+            [[nodiscard]] explicit operator bool() const noexcept { return m_ring; }
+            void reset() noexcept;
+        private:
+            BufferRing *m_ring{};
+            std::byte *m_data{};
+            size_t m_size{};
+            uint16_t m_id{};
+
+            friend struct BufferRing;
+            Lease(BufferRing *ring, uint16_t id, std::byte *data, size_t size) noexcept:
+                    m_ring(ring), m_data(data), m_size(size), m_id(id) {}
+        };
+
+        struct Received {
+            IOResult result;
+            Lease buffer;
+        };
+
+        // Turns the completion of a receive on this ring into its result and the lease of the buffer it filled
+        [[nodiscard]] Received lease(int32_t result, uint32_t flags) noexcept;
+    protected:
+        [[nodiscard]] virtual std::byte *buffer(uint16_t id) noexcept = 0;
+        virtual void recycle(uint16_t id) noexcept = 0;
+    };
+
+    struct SelectAwait : detail::AwaitCore {
+        template <class Fn> requires std::is_invocable_v<Fn, SelectAwait*>
+        explicit SelectAwait(BufferRing &ring, Fn&& fn) noexcept: AwaitCore(), m_ring(ring) { fn(this); }
+
+        [[nodiscard]] BufferRing::Received await_resume() noexcept { return m_ring.lease(get_result(), get_flags()); }
+    private:
+        BufferRing &m_ring;
+    };
+
+    // `count` must be a power of two no larger than 32768
+    std::unique_ptr<BufferRing> buffer_ring(unsigned count, size_t size);
+}
@@ -0,0 +1,45 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <memory>
+#include <cstdint>
+#include <string_view>
+#include "Block.h"
+#include "kls/coroutine/Async.h"
+#include "kls/essential/Memory.h"
+
+namespace kls::io {
+    // An append only file shared by many writers. Appends arriving while a batch is being written are gathered
+    //     into the next batch, which goes out as one vectored write linked to one data sync, so concurrent
+    //     appenders share a single flush. Space is preallocated a segment at a time ahead of the end of the log
+    struct AppendLog : PmrBase {
+        // Resumes once `data` is durable, with the offset it was written at.
+        // `data` has to stay untouched until then. After a failed write or sync every append fails
+        virtual coroutine::ValueAsync<uint64_t> append(Span<> data) = 0;
+        // Only once every append has completed
+        virtual IOAwait<Status> close() noexcept = 0;
+    };
+
+    coroutine::ValueAsync<std::unique_ptr<AppendLog>> append_log(std::string_view path, uint64_t segment = 64u << 20);
+}
@@ -0,0 +1,74 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+namespace kls::io {
+    struct RingConfig {
+        // Size of each submission queue, at least 2, and of each completion queue unless `cq_entries` is set.
+        // A larger completion queue lets bursts of completions land without overflowing into the kernel backlog
+        unsigned sq_entries{8192};
+        unsigned cq_entries{0};
+        // Give every submitting thread a ring of its own instead of sharing one process-wide ring.
+        // Submissions from different threads then never contend on the same submission queue.
+        // Completions are not reaped by the owning thread, as the executors have no hook to poll a ring from.
+        //     Every ring has a completion thread of its own instead, so this mode adds a thread per submitting
+        //     thread, and each completion still takes a hop to the executor of its await
+        bool per_thread{false};
+        // Accumulate prepared operations instead of entering the kernel once per operation.
+        // Pending operations are submitted by flush(), when the submission queue fills up,
+        //     once `submit_batch` of them are waiting, or when a coroutine suspends on one of them.
+        // Operations started back to back before the first co_await therefore go to the kernel together
+        bool deferred_submit{false};
+        unsigned submit_batch{64};
+        // Upper bound of completions taken off the completion queue before the completion thread
+        //     resumes their awaits and goes back to the kernel
+        unsigned reap_batch{256};
+        // Let a kernel thread poll the submission queue so that steady state submissions need no syscall.
+        // The poller goes to sleep after `sq_poll_idle` milliseconds without work and is pinned to
+        //     `sq_poll_cpu` unless it is negative. Per-thread rings all share the poller of the first ring
+        bool sq_poll{false};
+        unsigned sq_poll_idle{1000};
+        int sq_poll_cpu{-1};
+        // IORING_SETUP_COOP_TASKRUN, completions are posted when the task next enters the kernel instead of
+        //     interrupting it, which suits rings with a dedicated completion thread
+        bool coop_taskrun{false};
+        // IORING_SETUP_SINGLE_ISSUER, requires `per_thread`. A ring then stays with the first thread it is bound to
+        //     and is not handed to another thread once that thread exits.
+        // Cancels requested from other threads, through cancellable() or SocketTCP::cancel(), only take effect
+        //     once the owning thread next submits or suspends on an operation
+        bool single_issuer{false};
+        // Slots of the registered buffer table every ring is set up with, FixedBufferPool draws from it.
+        // Registration happens on every ring from the registering thread, so this does not go with `single_issuer`
+        unsigned fixed_buffers{0};
+        // Slots of the registered file table every ring is set up with, used by Block and SocketTCP register_file().
+        // Same as above, this does not go with `single_issuer`
+        unsigned fixed_files{0};
+    };
+
+    // Must be called before the first I/O operation is issued, throws exception_errc(IO_EBUSY) otherwise.
+    // Throws exception_errc(IO_EINVAL) for configurations the rings cannot be set up with
+    void configure(const RingConfig &config);
+
+    // Submits everything the calling thread has prepared but not yet handed to the kernel
+    void flush() noexcept;
+}
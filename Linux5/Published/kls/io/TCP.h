@@ -26,6 +26,8 @@
 #include <cstdint>
 #include <sys/uio.h>
 #include "Await.h"
+#include "Block.h"
+#include "Buffer.h"
 #include "kls/io/IP.h"
 #include "kls/Handle.h"
 #include "kls/coroutine/Async.h"
@@ -36,24 +38,83 @@ namespace kls::io {
         struct TCPHelper;
     }
 
-    struct IoVec : private iovec {
-        constexpr IoVec() noexcept = default;
-        IoVec(Span<> span) noexcept: IoVec(span.data(), span.size()) {}
-        IoVec(void* data, size_t size) noexcept: iovec{data, size} {}
+    // Completions of a multishot receive, each carrying the buffer the kernel filled.
+    // The stream ends with an error or a result of 0 for the end of the stream, later next() yield IO_ECANCELED.
+    // Dropping the stream cancels the receive, `buffers` has to outlive it
+    class RecvStream {
+    public:
+        struct Next {
+            detail::MultiCore::NextAwait inner;
+            BufferRing &buffers;
+
+            [[nodiscard]] constexpr bool await_ready() const noexcept { return false; }
+
+            bool await_suspend(std::coroutine_handle<> h) { return inner.await_suspend(h); }
+
+            [[nodiscard]] BufferRing::Received await_resume() const noexcept {
+                const auto [result, flags] = inner.await_resume();
+                return buffers.lease(result, flags);
+            }
+        };
+
+        RecvStream(RecvStream &&other) noexcept: m_core(std::exchange(other.m_core, nullptr)), m_buffers(other.m_buffers) {}
+        RecvStream &operator=(RecvStream &&other) = delete;
+        ~RecvStream() noexcept;
+        [[nodiscard]] Next next() noexcept { return Next{m_core->next(), m_buffers}; }
+    private:
+        detail::MultiCore *m_core;
+        BufferRing &m_buffers;
+
+        friend struct SocketTCP;
+        RecvStream(detail::MultiCore *core, BufferRing &buffers) noexcept: m_core(core), m_buffers(buffers) {}
     };
 
     struct SocketTCP: Handle<int> {
+        static constexpr size_t zero_copy_threshold = 16 * 1024;
         IOAwait<IOResult> read(Span<> buffer) noexcept;
         IOAwait<IOResult> write(Span<> buffer) noexcept;
         VecAwait readv(Span<IoVec> vec) noexcept;
         VecAwait writev(Span<IoVec> vec) noexcept;
+        // Sends without copying the data into the socket buffers. Resumes only once the kernel is done
+        //     reading from `buffer`, which has to stay untouched until then. Below `threshold` bytes
+        //     pinning the pages costs more than the copy, so those go through write() instead
+        IOAwait<IOResult> send_zc(Span<> buffer, size_t threshold = zero_copy_threshold) noexcept;
+        // Same for writev()
+        VecAwait sendmsg_zc(Span<IoVec> vec, size_t threshold = zero_copy_threshold) noexcept;
+        // The same operations described for chain()
+        LinkedOp read_op(Span<> buffer) noexcept;
+        LinkedOp write_op(Span<> buffer) noexcept;
+        // Variants that give up with IO_ETIMEDOUT once `limit` has passed. A timed out write may have sent a part
+        TimedAwait<IOAwait<IOResult>> read(Span<> buffer, std::chrono::nanoseconds limit) noexcept;
+        TimedAwait<IOAwait<IOResult>> write(Span<> buffer, std::chrono::nanoseconds limit) noexcept;
+        TimedAwait<VecAwait> readv(Span<IoVec> vec, std::chrono::nanoseconds limit) noexcept;
+        TimedAwait<VecAwait> writev(Span<IoVec> vec, std::chrono::nanoseconds limit) noexcept;
+        // Receives into a buffer the kernel picks from `buffers` once data arrives.
+        // The receive goes to the ring of `buffers`. With single_issuer only the thread that created `buffers`
+        //     may submit there, calls from any other thread complete at once with IO_EEXIST
+        SelectAwait recv_select(BufferRing &buffers) noexcept;
+        // Keeps receiving into buffers picked from `buffers` with a single multishot receive.
+        // Same as above, from another thread under single_issuer the stream ends at once with IO_EEXIST
+        RecvStream recv_stream(BufferRing &buffers);
+        // Cancels every operation in flight on the socket, they complete with IO_ECANCELED
+        void cancel() noexcept;
         IOAwait<Status> close() noexcept;
+        // Places the socket in the registered file table of the rings, so that operations on it skip
+        //     taking a reference to the file every time. close() gives the slot back
+        Status register_file() noexcept;
     private:
+        int m_slot{-1};
+        // The rings operations on the socket went to, for cancel() to visit only those
+        alignas(8) uint64_t m_rings{};
         friend struct ::kls::io::detail::TCPHelper;
         explicit SocketTCP(int h);
     };
 
     coroutine::ValueAsync<SafeHandle<SocketTCP>> connect(Address address, int port);
+    // Throws IO_ETIMEDOUT if the connection is not established within `limit`
+    coroutine::ValueAsync<SafeHandle<SocketTCP>> connect(Address address, int port, std::chrono::nanoseconds limit);
+
+    struct AcceptStream;
 
     struct AcceptorTCP : PmrBase {
         struct Result {
@@ -62,8 +123,30 @@ namespace kls::io {
         };
 
         virtual coroutine::ValueAsync<Result> once() = 0;
+        // Throws IO_ETIMEDOUT if no connection arrives within `limit`
+        virtual coroutine::ValueAsync<Result> once(std::chrono::nanoseconds limit) = 0;
+        // Keeps accepting with a single multishot accept. Once `backlog` accepted connections are waiting
+        //     to be picked up, accepting pauses and further connections wait in the listen backlog instead.
+        // The pause takes effect on the next call to next(), connections accepted until then are queued as well
+        virtual std::unique_ptr<AcceptStream> stream(size_t backlog) = 0;
         virtual IOAwait<Status> close() noexcept = 0;
     };
 
+    struct AcceptStream : PmrBase {
+        virtual coroutine::ValueAsync<AcceptorTCP::Result> next() = 0;
+    };
+
     std::unique_ptr<AcceptorTCP> acceptor_tcp(Address address, int port, int backlog);
+
+    // One SO_REUSEPORT listener per shard on the same address, meant for one accept loop per executor thread.
+    // Accepts and the I/O of the accepted connections are submitted to the ring of the thread running the loop.
+    // With `steer`, a classic BPF program hands every connection to the listener of index (CPU % shards),
+    //     so running the loop of shard i on a thread pinned to CPU i keeps a connection on one core throughout
+    std::vector<std::unique_ptr<AcceptorTCP>> acceptor_tcp_sharded(
+            Address address, int port, int backlog, int shards, bool steer = false
+    );
+
+    // Sends `length` bytes of `file` from `offset` by splicing them through a pipe, so the data never
+    //     passes through user space. Fails with IO_EIO if the file ends first
+    coroutine::ValueAsync<Status> send_file(SocketTCP &socket, Block &file, uint64_t offset, uint64_t length);
 }
\ No newline at end of file
@@ -0,0 +1,61 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <memory>
+#include <chrono>
+#include "Await.h"
+#include "kls/coroutine/Async.h"
+#include "kls/essential/Memory.h"
+
+namespace kls::io {
+    // Resumes with IO_OK once the time has come, or with IO_ECANCELED if cancelled before that
+    struct SleepAwait : private detail::TimeoutSpec, detail::AwaitCore {
+        [[nodiscard]] Status await_resume() const noexcept {
+            // a timeout that runs out completes with -ETIME
+            return get_result() == -ETIME ? IO_OK : detail::map_error(get_result());
+        }
+    private:
+        SleepAwait(std::chrono::nanoseconds time, unsigned flags) noexcept;
+        friend SleepAwait sleep_for(std::chrono::nanoseconds duration) noexcept;
+        friend SleepAwait sleep_until(std::chrono::steady_clock::time_point time) noexcept;
+        friend SleepAwait sleep_until(std::chrono::system_clock::time_point time) noexcept;
+    };
+
+    SleepAwait sleep_for(std::chrono::nanoseconds duration) noexcept;
+    SleepAwait sleep_until(std::chrono::steady_clock::time_point time) noexcept;
+    // Follows changes to the wall clock while waiting
+    SleepAwait sleep_until(std::chrono::system_clock::time_point time) noexcept;
+
+    // Ticks every period on the ring of the thread that created it, until dropped.
+    // Ticks pile up while nobody waits for them, and past a bound the backlog is dropped and the period restarts.
+    // Kernels before 6.4 have no multishot timeouts, the timer then falls back to a one shot timeout that next()
+    //     renews as it hands out each tick. Ticks never pile up there, and each period counts from that next(),
+    //     so the ticks drift by however long the consumer takes to come back
+    struct Timer : PmrBase {
+        // Resumes with IO_OK at the next tick, or with the error that stopped the timer
+        virtual coroutine::ValueAsync<Status> next() = 0;
+    };
+
+    std::unique_ptr<Timer> timer(std::chrono::nanoseconds period);
+}
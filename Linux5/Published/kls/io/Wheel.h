@@ -0,0 +1,100 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include "TCP.h"
+#include "kls/coroutine/Async.h"
+
+namespace kls::io {
+    namespace detail {
+        struct WheelNode {
+            WheelNode *prev{}, *next{};
+
+            void unlink() noexcept {
+                if (next) next->prev = prev, prev->next = next, prev = next = nullptr;
+            }
+        };
+    }
+
+    // A deadline kept by a TimerWheel, usually embedded in the state of a connection. Unlinks itself when destroyed
+    class WheelEntry : private detail::WheelNode {
+    public:
+        WheelEntry() noexcept = default;
+        WheelEntry(const WheelEntry &) = delete;
+        WheelEntry &operator=(const WheelEntry &) = delete;
+        virtual ~WheelEntry() noexcept { unlink(); }
+        [[nodiscard]] bool armed() const noexcept { return next != nullptr; }
+    protected:
+        // Called by the wheel once the deadline has passed, the entry is disarmed by then and may be armed again
+        virtual void expired() noexcept = 0;
+    private:
+        uint64_t m_expiry{};
+        friend class TimerWheel;
+    };
+
+    // Cancels every operation in flight on a socket once the deadline passes, as an idle or keepalive timeout
+    class SocketDeadline : public WheelEntry {
+    public:
+        explicit SocketDeadline(SocketTCP &socket) noexcept: m_socket(socket) {}
+    protected:
+        void expired() noexcept override { m_socket.cancel(); }
+    private:
+        SocketTCP &m_socket;
+    };
+
+    // Hierarchical timing wheel of four levels of 256 slots, a slot of the lowest level spanning one tick.
+    // Arming, re-arming and cancelling are O(1) and cost no system call, as all deadlines share one ring timer.
+    // Deadlines are rounded up to whole ticks and capped at 2^32 ticks.
+    // Not thread safe, entries have to be armed and cancelled on the executor that runs the wheel
+    class TimerWheel {
+    public:
+        explicit TimerWheel(std::chrono::nanoseconds resolution = std::chrono::milliseconds(10)) noexcept;
+        TimerWheel(const TimerWheel &) = delete;
+        TimerWheel &operator=(const TimerWheel &) = delete;
+        ~TimerWheel() noexcept;
+        // Arms `entry` to expire after `delay`, moving it if it was armed already
+        void arm(WheelEntry &entry, std::chrono::nanoseconds delay) noexcept;
+        void cancel(WheelEntry &entry) noexcept { entry.unlink(); }
+        // Expires every entry due by `now`
+        void advance(std::chrono::steady_clock::time_point now) noexcept;
+        // Advances the wheel on every tick of a ring timer until stop() is called
+        coroutine::ValueAsync<void> run();
+        void stop() noexcept { m_stopped = true; }
+    private:
+        static constexpr unsigned slot_bits = 8, slot_count = 1u << slot_bits, level_count = 4;
+        using Level = std::array<detail::WheelNode, slot_count>;
+
+        const std::chrono::nanoseconds m_resolution;
+        const std::chrono::steady_clock::time_point m_start;
+        // the next tick to process
+        uint64_t m_now{0};
+        bool m_stopped{false};
+        std::array<Level, level_count> m_levels{};
+
+        void insert(WheelEntry &entry) noexcept;
+        void tick() noexcept;
+    };
+}
@@ -23,6 +23,8 @@
 #include "kls/io/Block.h"
 #include "kls/temp/STL.h"
 #include <string>
+#include <utility>
+#include <algorithm>
 #include <vector>
 #include "IOCP.h"
 
@@ -83,6 +85,19 @@ namespace {
         return ((flags & Block::F_EXLOCK) ? 0u : (FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE));
     }
 
+    DWORD ntos_file_make_attributes(uint32_t flags) noexcept {
+        const DWORD direct = (flags & Block::F_DIRECT) ? FILE_FLAG_NO_BUFFERING : 0ul;
+        return FILE_FLAG_OVERLAPPED | FILE_FLAG_WRITE_THROUGH | direct;
+    }
+
+    // The sector size unbuffered I/O on `handle` has to be aligned to
+    uint32_t ntos_direct_alignment(HANDLE handle) noexcept {
+        FILE_STORAGE_INFO info{};
+        if (!GetFileInformationByHandleEx(handle, FileStorageInfo, &info, sizeof(info))) return 4096;
+        const auto size = std::max<uint32_t>(info.LogicalBytesPerSector, info.PhysicalBytesPerSectorForPerformance);
+        return size ? size : 4096;
+    }
+
     auto ntos_create_file(std::string_view path_utf8, uint32_t flags) {
         const auto path = ntos_get_path(path_utf8);
         const auto hFile = CreateFileW(
@@ -91,7 +106,7 @@ namespace {
                 ntos_file_make_share(flags),
                 nullptr,
                 ntos_file_make_creation_disposition(flags),
-                FILE_FLAG_OVERLAPPED | FILE_FLAG_WRITE_THROUGH,
+                ntos_file_make_attributes(flags),
                 nullptr
         );
         if (hFile == INVALID_HANDLE_VALUE) {
@@ -125,9 +140,14 @@ namespace kls::io {
 
     coroutine::ValueAsync<SafeHandle<Block>> Block::open(std::string_view path, uint32_t flags) {
         auto absolute = std::filesystem::absolute({path}).generic_string();
-        co_return SafeHandle(Block(reinterpret_cast<uintptr_t>(ntos_create_file(absolute, flags))));
+        const auto handle = ntos_create_file(absolute, flags);
+        Block block{reinterpret_cast<uintptr_t>(handle)};
+        if (flags & F_DIRECT) block.m_align = ntos_direct_alignment(handle);
+        co_return SafeHandle(std::move(block));
     }
 
+    AlignedBuffer Block::aligned_buffer(size_t size) const { return AlignedBuffer{size, std::max(m_align, 64u)}; }
+
     Block::Block(uintptr_t h): Handle<uintptr_t>([](uintptr_t h) noexcept {}, h) {}
 
     IOAwait<IOResult> Block::read(Span<> span, uint64_t offset) noexcept {
@@ -159,6 +179,28 @@ namespace kls::io {
         };
     }
 
+    // ReadFileScatter and WriteFileGather only take whole, page aligned pages on handles opened without buffering,
+    //     so the buffers go one overlapped operation after another
+    template<class Fn>
+    static coroutine::ValueAsync<IOResult> vectored(Span<IoVec> vec, uint64_t offset, Fn fn) {
+        int32_t total = 0;
+        for (const auto &v: reinterpret_span_cast<WSABUF>(vec)) {
+            const auto res = co_await fn(Span<>{v.buf, v.len}, offset + total);
+            if (!res.success()) co_return total ? IOResult(IO_OK, total) : res;
+            total += res.result();
+            if (static_cast<ULONG>(res.result()) < v.len) break;
+        }
+        co_return IOResult(IO_OK, total);
+    }
+
+    coroutine::ValueAsync<IOResult> Block::readv(Span<IoVec> vec, uint64_t offset) {
+        return vectored(vec, offset, [this](Span<> span, uint64_t at) { return read(span, at); });
+    }
+
+    coroutine::ValueAsync<IOResult> Block::writev(Span<IoVec> vec, uint64_t offset) {
+        return vectored(vec, offset, [this](Span<> span, uint64_t at) { return write(span, at); });
+    }
+
     Await Block::sync() noexcept {
         auto handle = reinterpret_cast<HANDLE>(value());
         return {
@@ -168,6 +210,125 @@ namespace kls::io {
         };
     }
 
+    // FlushFileBuffers always covers the metadata as well
+    Await Block::sync_all() noexcept { return sync(); }
+
+    Await Block::sync_range(uint64_t offset, uint64_t length, uint32_t flags) noexcept { return sync(); }
+
+    static DWORD ntos_set_end_of_file(HANDLE handle, uint64_t length) noexcept {
+        FILE_END_OF_FILE_INFO info{};
+        info.EndOfFile.QuadPart = static_cast<LONGLONG>(length);
+        if (SetFileInformationByHandle(handle, FileEndOfFileInfo, &info, sizeof(info))) return ERROR_SUCCESS;
+        return GetLastError();
+    }
+
+    Await Block::allocate(uint64_t offset, uint64_t length, uint32_t mode) noexcept {
+        auto handle = reinterpret_cast<HANDLE>(value());
+        return {
+                [handle, offset, length, mode]() noexcept -> DWORD {
+                    if (mode & (A_PUNCH_HOLE | A_ZERO_RANGE)) return ERROR_NOT_SUPPORTED;
+                    FILE_STANDARD_INFO standard{};
+                    if (!GetFileInformationByHandleEx(handle, FileStandardInfo, &standard, sizeof(standard)))
+                        return GetLastError();
+                    const auto end = offset + length;
+                    const auto size = static_cast<uint64_t>(standard.EndOfFile.QuadPart);
+                    const auto allocated = static_cast<uint64_t>(standard.AllocationSize.QuadPart);
+                    // an allocation below the end of file truncates it, and one below the current allocation
+                    //     gives reserved space back, so it is only ever grown
+                    if (end > size && end > allocated) {
+                        FILE_ALLOCATION_INFO info{};
+                        info.AllocationSize.QuadPart = static_cast<LONGLONG>(end);
+                        if (!SetFileInformationByHandle(handle, FileAllocationInfo, &info, sizeof(info)))
+                            return GetLastError();
+                    }
+                    if ((mode & A_KEEP_SIZE) || end <= size) return ERROR_SUCCESS;
+                    return ntos_set_end_of_file(handle, end);
+                }
+        };
+    }
+
+    Await Block::advise(uint64_t offset, uint64_t length, Advice advice) noexcept {
+        return {[]() noexcept -> DWORD { return ERROR_SUCCESS; }};
+    }
+
+    Await Block::truncate(uint64_t length) noexcept {
+        auto handle = reinterpret_cast<HANDLE>(value());
+        return {[handle, length]() noexcept -> DWORD { return ntos_set_end_of_file(handle, length); }};
+    }
+
+    coroutine::ValueAsync<Status> Block::copy_from(Block &source, uint64_t from, uint64_t to, uint64_t length) {
+        constexpr uint64_t step = 1u << 20;
+        std::vector<std::byte> buffer(static_cast<size_t>(std::min(length, step)));
+        while (length) {
+            const auto chunk = static_cast<size_t>(std::min(length, step));
+            const auto read = co_await source.read(Span<>(buffer.data(), chunk), from);
+            if (!read.success()) co_return read.error();
+            if (!read.result()) co_return IO_EIO;
+            const auto size = static_cast<size_t>(read.result());
+            for (size_t done = 0; done < size;) {
+                const auto written = co_await write(Span<>(buffer.data() + done, size - done), to + done);
+                if (!written.success()) co_return written.error();
+                if (!written.result()) co_return IO_EIO;
+                done += static_cast<size_t>(written.result());
+            }
+            from += size, to += size, length -= size;
+        }
+        co_return IO_OK;
+    }
+
+    MappedView Block::map(uint64_t offset, size_t length, uint32_t flags) {
+        auto handle = reinterpret_cast<HANDLE>(value());
+        if (!length) {
+            LARGE_INTEGER size{};
+            if (!GetFileSizeEx(handle, &size)) throw exception_errc(map_error(GetLastError()));
+            if (offset >= static_cast<uint64_t>(size.QuadPart)) throw exception_errc(IO_EINVAL);
+            length = static_cast<size_t>(static_cast<uint64_t>(size.QuadPart) - offset);
+        }
+        // views start at multiples of the allocation granularity, so the data may start inside the view
+        SYSTEM_INFO info{};
+        GetSystemInfo(&info);
+        const auto skip = offset % info.dwAllocationGranularity;
+        const auto start = offset - skip;
+        const auto mapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) throw exception_errc(map_error(GetLastError()));
+        const auto base = MapViewOfFile(
+                mapping, FILE_MAP_READ, static_cast<DWORD>(start >> 32), static_cast<DWORD>(start), length + skip
+        );
+        // the view keeps the mapping object alive on its own
+        const auto error = base ? ERROR_SUCCESS : GetLastError();
+        CloseHandle(mapping);
+        if (!base) throw exception_errc(map_error(error));
+        auto view = MappedView{base, static_cast<std::byte *>(base) + skip, length};
+        if (flags & M_POPULATE) view.prefault();
+        return view;
+    }
+
+    MappedView::MappedView(MappedView &&other) noexcept:
+            m_base(std::exchange(other.m_base, nullptr)), m_data(other.m_data), m_size(other.m_size) {}
+
+    MappedView &MappedView::operator=(MappedView &&other) noexcept {
+        if (this != &other) {
+            if (m_base) UnmapViewOfFile(m_base);
+            m_base = std::exchange(other.m_base, nullptr);
+            m_data = other.m_data, m_size = other.m_size;
+        }
+        return *this;
+    }
+
+    MappedView::~MappedView() noexcept { if (m_base) UnmapViewOfFile(m_base); }
+
+    Await MappedView::prefault() const noexcept {
+        WIN32_MEMORY_RANGE_ENTRY range{m_data, m_size};
+        return {
+                [range]() noexcept -> DWORD {
+                    if (!range.VirtualAddress) return ERROR_SUCCESS;
+                    auto entry = range;
+                    if (PrefetchVirtualMemory(GetCurrentProcess(), 1, &entry, 0)) return ERROR_SUCCESS;
+                    return GetLastError();
+                }
+        };
+    }
+
     Await Block::close() noexcept {
         auto handle = reinterpret_cast<HANDLE>(value());
         return {
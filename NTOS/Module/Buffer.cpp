@@ -0,0 +1,48 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#include "kls/io/Buffer.h"
+#include <malloc.h>
+
+namespace kls::io {
+    // validated ahead of rounding, which would divide by a zero alignment
+    static size_t aligned_size(size_t size, size_t alignment) {
+        if (!alignment || (alignment & (alignment - 1))) throw exception_errc(IO_EINVAL);
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    AlignedBuffer::AlignedBuffer(size_t size, size_t alignment) : m_size(aligned_size(size, alignment)) {
+        m_data = static_cast<std::byte *>(_aligned_malloc(m_size ? m_size : alignment, alignment));
+        if (!m_data) throw exception_errc(IO_ENOMEM);
+    }
+
+    AlignedBuffer &AlignedBuffer::operator=(AlignedBuffer &&other) noexcept {
+        if (this != &other) {
+            _aligned_free(m_data);
+            m_data = std::exchange(other.m_data, nullptr), m_size = other.m_size;
+        }
+        return *this;
+    }
+
+    AlignedBuffer::~AlignedBuffer() noexcept { _aligned_free(m_data); }
+}
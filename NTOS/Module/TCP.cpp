@@ -24,6 +24,7 @@
 #include "WSA.h"
 #include "IOCP.h"
 #include <MSWSock.h>
+#include <algorithm>
 #include <stdexcept>
 #include "kls/io/TCP.h"
 #include "kls/essential/Final.h"
@@ -300,4 +301,27 @@ namespace kls::io {
                 throw std::runtime_error("Invalid Peer Family");
         }
     }
+
+    static IOAwait<IOResult> transmit(SOCKET socket, HANDLE file, uint64_t offset, DWORD length) noexcept {
+        return {
+                [=](LPOVERLAPPED o) noexcept -> DWORD {
+                    o->Offset = static_cast<DWORD>(offset);
+                    o->OffsetHigh = static_cast<DWORD>(offset >> 32);
+                    return WSAO(TransmitFile(socket, file, length, 0, o, nullptr, 0), TRUE);
+                }
+        };
+    }
+
+    coroutine::ValueAsync<Status> send_file(SocketTCP &socket, Block &file, uint64_t offset, uint64_t length) {
+        // TransmitFile takes less than 2 GiB per call
+        constexpr uint64_t step = 1u << 30;
+        while (length) {
+            const auto chunk = static_cast<DWORD>(std::min(length, step));
+            const auto res = co_await transmit(socket.value(), reinterpret_cast<HANDLE>(file.value()), offset, chunk);
+            if (!res.success()) co_return res.error();
+            if (!res.result()) co_return IO_EIO;
+            offset += res.result(), length -= res.result();
+        }
+        co_return IO_OK;
+    }
 }
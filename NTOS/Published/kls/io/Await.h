@@ -25,6 +25,7 @@
 #include <limits>
 #include <utility>
 #include <concepts>
+#include "kls/Span.h"
 #include "kls/io/Status.h"
 #include "kls/hal/System.h"
 #include "kls/coroutine/Trigger.h"
@@ -36,6 +37,20 @@ namespace kls::io::detail {
 }
 
 namespace kls::io {
+    struct IoVec : private WSABUF {
+        constexpr IoVec() noexcept = default;
+
+        IoVec(Span<> span) noexcept { //NOLINT
+            len = static_cast<ULONG>(span.size());
+            buf = static_cast<char*>(span.data());
+        }
+
+        IoVec(void* data, size_t size) noexcept { //NOLINT
+            len = static_cast<ULONG>(size);
+            buf = static_cast<char*>(data);
+        }
+    };
+
     // on windows, non-IOCP io related operation is never async
     class Await : public AddressSensitive {
     public:
@@ -25,11 +25,35 @@
 #include <cstdint>
 #include <string_view>
 #include "Await.h"
+#include "Buffer.h"
 #include "kls/Handle.h"
 #include "kls/coroutine/Async.h"
 #include "kls/essential/Memory.h"
 
 namespace kls::io {
+    // A read only view of a range of a file mapped into memory, unmapped when destroyed
+    class MappedView {
+    public:
+        MappedView() noexcept = default;
+        MappedView(MappedView &&other) noexcept;
+        MappedView &operator=(MappedView &&other) noexcept;
+        ~MappedView() noexcept;
+        [[nodiscard]] const std::byte *data() const noexcept { return m_data; }
+        [[nodiscard]] size_t size() const noexcept { return m_size; }
+        // Writing through the span faults
+        [[nodiscard]] Span<> span() const noexcept { return Span<>(m_data, m_size); }
+        [[nodiscard]] explicit operator bool() const noexcept { return m_base; }
+        // Starts reading the pages of the view in without waiting for them
+        Await prefault() const noexcept;
+    private:
+        void *m_base{};
+        std::byte *m_data{};
+        size_t m_size{};
+
+        friend struct Block;
+        MappedView(void *base, std::byte *data, size_t size) noexcept: m_base(base), m_data(data), m_size(size) {}
+    };
+
 	struct Block: Handle<uintptr_t> {
         enum Flag {
             F_READ = 1ul,
@@ -37,15 +61,77 @@ namespace kls::io {
             F_CREAT = 4ul,
             F_EXCL = 8ul,
             F_TRUNC = 16ul,
-            F_EXLOCK = 32ul
+            F_EXLOCK = 32ul,
+            // Bypasses the system cache. Buffers, sizes and offsets must then be multiples of alignment(),
+            //     operations on anything else fail with IO_EINVAL
+            F_DIRECT = 64ul,
+            // Implied, files are always opened for write through
+            F_DSYNC = 128ul,
+            // No equivalent, ignored
+            F_NOATIME = 256ul
+        };
+
+        enum Allocation {
+            // Leaves the file size alone when allocating past the end
+            A_KEEP_SIZE = 1ul,
+            // Not supported, fails with IO_ENOTSUP
+            A_PUNCH_HOLE = 2ul,
+            A_ZERO_RANGE = 4ul
+        };
+
+        // Ranges are not tracked by the system cache, a range sync flushes the whole file
+        enum SyncRange {
+            SR_WAIT_BEFORE = 1ul,
+            SR_WRITE = 2ul,
+            SR_WAIT_AFTER = 4ul
+        };
+
+        // Hints only, the system cache has no per range advice
+        enum Advice {
+            ADVICE_NORMAL,
+            ADVICE_SEQUENTIAL,
+            ADVICE_RANDOM,
+            ADVICE_WILLNEED,
+            ADVICE_DONTNEED,
+            ADVICE_NOREUSE
+        };
+
+        // Views have no paging hints, only M_POPULATE has an effect
+        enum Mapping {
+            M_POPULATE = 1ul,
+            M_HUGEPAGE = 2ul,
+            M_SEQUENTIAL = 4ul,
+            M_RANDOM = 8ul
         };
 
         static coroutine::ValueAsync<SafeHandle<Block>> open(std::string_view path, uint32_t flags);
+        // What buffers, sizes and offsets have to be multiples of, the sector size of the volume under F_DIRECT
+        [[nodiscard]] uint32_t alignment() const noexcept { return m_align; }
+        // A buffer suitable for I/O on this file, its size rounded up to the alignment
+        [[nodiscard]] AlignedBuffer aligned_buffer(size_t size) const;
 		IOAwait<IOResult> read(Span<> span, uint64_t offset) noexcept;
 		IOAwait<IOResult> write(Span<> span, uint64_t offset) noexcept;
+        // Reads into or writes from the buffers of `vec` in order, starting at `offset`, up to the first short transfer
+        coroutine::ValueAsync<IOResult> readv(Span<IoVec> vec, uint64_t offset);
+        coroutine::ValueAsync<IOResult> writev(Span<IoVec> vec, uint64_t offset);
         Await sync() noexcept;
+        Await sync_all() noexcept;
+        Await sync_range(
+                uint64_t offset, uint64_t length, uint32_t flags = SR_WAIT_BEFORE | SR_WRITE | SR_WAIT_AFTER
+        ) noexcept;
+        // Reserves space for the file up to offset + length
+        Await allocate(uint64_t offset, uint64_t length, uint32_t mode = 0) noexcept;
+        Await advise(uint64_t offset, uint64_t length, Advice advice) noexcept;
+        Await truncate(uint64_t length) noexcept;
+        // Maps `length` bytes from `offset` for reading, a length of 0 maps up to the end of the file.
+        // Throws exception_errc on failure
+        [[nodiscard]] MappedView map(uint64_t offset, size_t length = 0, uint32_t flags = 0);
+        // Copies `length` bytes of `source` from offset `from` into this file at `to`.
+        // There is no ranged kernel side copy, the data goes through a buffer. Fails with IO_EIO if `source` ends first
+        coroutine::ValueAsync<Status> copy_from(Block &source, uint64_t from, uint64_t to, uint64_t length);
         Await close() noexcept;
     private:
+        uint32_t m_align{1};
         explicit Block(uintptr_t h);
 	};
 }
@@ -0,0 +1,46 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <utility>
+#include <cstdint>
+#include "Await.h"
+#include "kls/Span.h"
+
+namespace kls::io {
+    // Memory aligned for unbuffered I/O, with its size rounded up to a multiple of the alignment
+    class AlignedBuffer {
+    public:
+        AlignedBuffer(size_t size, size_t alignment);
+        AlignedBuffer(AlignedBuffer &&other) noexcept: m_data(std::exchange(other.m_data, nullptr)), m_size(other.m_size) {}
+        AlignedBuffer &operator=(AlignedBuffer &&other) noexcept;
+        ~AlignedBuffer() noexcept;
+        [[nodiscard]] std::byte *data() const noexcept { return m_data; }
+        [[nodiscard]] size_t size() const noexcept { return m_size; }
+        [[nodiscard]] Span<> span() const noexcept { return Span<>(m_data, m_size); }
+    private:
+        std::byte *m_data;
+        size_t m_size;
+    };
+}
@@ -25,6 +25,7 @@
 #include <vector>
 #include <cstdint>
 #include "Await.h"
+#include "Block.h"
 #include "kls/io/IP.h"
 #include "kls/Handle.h"
 #include "kls/coroutine/Async.h"
@@ -35,20 +36,6 @@ namespace kls::io {
         struct TCPHelper;
     }
 
-    struct IoVec : private WSABUF {
-        constexpr IoVec() noexcept = default;
-
-        IoVec(Span<> span) noexcept { //NOLINT
-            len = static_cast<ULONG>(span.size());
-            buf = static_cast<char*>(span.data());
-        }
-
-        IoVec(void* data, size_t size) noexcept { //NOLINT
-            len = static_cast<ULONG>(size);
-            buf = static_cast<char*>(data);
-        }
-    };
-
     struct SocketTCP: Handle<uintptr_t> {
         IOAwait<IOResult> read(Span<> buffer) noexcept;
         IOAwait<IOResult> write(Span<> buffer) noexcept;
@@ -73,4 +60,8 @@ namespace kls::io {
     };
 
     std::unique_ptr<AcceptorTCP> acceptor_tcp(Address address, int port, int backlog);
+
+    // Sends `length` bytes of `file` from `offset` with TransmitFile, so the data never passes through
+    //     user space. Fails with IO_EIO if the file ends first
+    coroutine::ValueAsync<Status> send_file(SocketTCP &socket, Block &file, uint64_t offset, uint64_t length);
 }
\ No newline at end of file
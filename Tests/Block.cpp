@@ -20,11 +20,16 @@
 * SOFTWARE.
 */
 
+#include <cstring>
 #include <filesystem>
 #include <gtest/gtest.h>
 #include "kls/io/Block.h"
 #include "kls/coroutine/Blocking.h"
 #include "kls/coroutine/Operation.h"
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 TEST(kls_io, FileEcho) {
     using namespace kls::io;
@@ -63,4 +68,367 @@ TEST(kls_io, FileEcho) {
         }
     });
     ASSERT_TRUE(success);
-}
\ No newline at end of file
+}
+
+TEST(kls_io, FileVector) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    auto success = run_blocking([&]() -> ValueAsync<bool> {
+        auto file = co_await Block::open("./test.kls.io.vector.temp", Block::F_READ | Block::F_WRITE | Block::F_CREAT);
+        const auto result = co_await uses(file, [](Block &file) -> ValueAsync<bool> {
+            char header[4]{'H', 'E', 'A', 'D'}, payload[8]{'p', 'a', 'y', 'l', 'o', 'a', 'd', '!'}, check[4]{1, 2, 3, 4};
+            IoVec out[]{{header, 4}, {payload, 8}, {check, 4}};
+            if ((co_await file.writev({out, 3}, 16)).get_result() != 16) co_return false;
+            char first[10]{}, second[6]{};
+            IoVec in[]{{first, 10}, {second, 6}};
+            if ((co_await file.readv({in, 2}, 16)).get_result() != 16) co_return false;
+            co_return std::string_view(first, 10) == "HEADpayloa" && std::string_view(second, 6) == "d!\1\2\3\4";
+        });
+        std::filesystem::remove_all("./test.kls.io.vector.temp");
+        co_return result;
+    });
+    ASSERT_TRUE(success);
+}
+
+TEST(kls_io, FileMap) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    static constexpr auto payload = std::string_view("Hello World\n");
+
+    auto success = run_blocking([&]() -> ValueAsync<bool> {
+        auto file = co_await Block::open("./test.kls.io.map.temp", Block::F_READ | Block::F_WRITE | Block::F_CREAT);
+        const auto result = co_await uses(file, [](Block &file) -> ValueAsync<bool> {
+            if ((co_await file.write({payload.data(), payload.size()}, 0)).get_result() != payload.size()) co_return false;
+            // the view is gone before the file is closed
+            const auto view = file.map(6, 0, Block::M_POPULATE);
+            if (co_await view.prefault() != IO_OK) co_return false;
+            co_return std::string_view(reinterpret_cast<const char *>(view.data()), view.size()) == "World\n";
+        });
+        std::filesystem::remove_all("./test.kls.io.map.temp");
+        co_return result;
+    });
+    ASSERT_TRUE(success);
+}
+
+TEST(kls_io, FileCopy) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    static constexpr auto payload = std::string_view("Hello World\n");
+
+    auto success = run_blocking([&]() -> ValueAsync<bool> {
+        auto source = co_await Block::open("./test.kls.io.copy.in.temp", Block::F_READ | Block::F_WRITE | Block::F_CREAT);
+        auto target = co_await Block::open("./test.kls.io.copy.out.temp", Block::F_READ | Block::F_WRITE | Block::F_CREAT);
+        const auto result = co_await uses(source, [&](Block &source) -> ValueAsync<bool> {
+            co_return co_await uses(target, [&](Block &target) -> ValueAsync<bool> {
+                if ((co_await source.write({payload.data(), payload.size()}, 0)).get_result() != payload.size()) co_return false;
+                if (co_await target.copy_from(source, 6, 2, 6) != IO_OK) co_return false;
+                // running past the end of the source
+                if (co_await target.copy_from(source, 6, 0, 100) != IO_EIO) co_return false;
+                char buffer[8]{};
+                if ((co_await target.read({buffer, 8}, 0)).get_result() != 8) co_return false;
+                co_return std::string_view(buffer, 8) == "World\nd\n";
+            });
+        });
+        std::filesystem::remove_all("./test.kls.io.copy.in.temp");
+        std::filesystem::remove_all("./test.kls.io.copy.out.temp");
+        co_return result;
+    });
+    ASSERT_TRUE(success);
+}
+
+TEST(kls_io, FileAlignedBuffer) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    const AlignedBuffer buffer{100, 64};
+    ASSERT_EQ(buffer.size(), 128);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(buffer.data()) % 64, 0);
+    ASSERT_EQ(AlignedBuffer(0, 64).size(), 0);
+    for (const size_t alignment: {0, 3, 48}) {
+        try {
+            AlignedBuffer{100, alignment};
+            FAIL() << "An alignment of " << alignment << " was taken";
+        }
+        catch (exception_errc &e) { ASSERT_EQ(e.errc, IO_EINVAL); }
+    }
+
+    // without F_DIRECT nothing has to be aligned, the buffers are still cache line aligned
+    auto success = run_blocking([&]() -> ValueAsync<bool> {
+        auto file = co_await Block::open("./test.kls.io.aligned.temp", Block::F_READ | Block::F_WRITE | Block::F_CREAT);
+        const auto result = co_await uses(file, [](Block &file) -> ValueAsync<bool> {
+            const auto buffer = file.aligned_buffer(10);
+            co_return file.alignment() == 1 && buffer.size() == 64;
+        });
+        std::filesystem::remove_all("./test.kls.io.aligned.temp");
+        co_return result;
+    });
+    ASSERT_TRUE(success);
+}
+
+TEST(kls_io, FileSync) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    static constexpr auto path = "./test.kls.io.sync.temp";
+
+    auto success = run_blocking([&]() -> ValueAsync<bool> {
+        auto file = co_await Block::open(path, Block::F_READ | Block::F_WRITE | Block::F_CREAT | Block::F_TRUNC);
+        const auto result = co_await uses(file, [](Block &file) -> ValueAsync<bool> {
+            char data[4096], in[4096]{};
+            for (int i = 0; i < 4096; ++i) data[i] = static_cast<char>(i * 3);
+            if ((co_await file.write({data, 4096}, 0)).get_result() != 4096) co_return false;
+            if (co_await file.sync_all() != IO_OK) co_return false;
+            if ((co_await file.write({data, 1024}, 4096)).get_result() != 1024) co_return false;
+            // each stage of a range sync on its own, then all of them over a length that stands for the rest
+            for (const auto flags: {Block::SR_WAIT_BEFORE, Block::SR_WRITE, Block::SR_WAIT_AFTER})
+                if (co_await file.sync_range(4096, 1024, flags) != IO_OK) co_return false;
+            if (co_await file.sync_range(0, uint64_t(1) << 40) != IO_OK) co_return false;
+            if ((co_await file.read({in, 4096}, 0)).get_result() != 4096) co_return false;
+            co_return std::memcmp(in, data, 4096) == 0 && std::filesystem::file_size(path) == 5120;
+        });
+        std::filesystem::remove_all(path);
+        co_return result;
+    });
+    ASSERT_TRUE(success);
+}
+
+TEST(kls_io, FileAllocate) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    static constexpr auto path = "./test.kls.io.allocate.temp";
+
+    auto success = run_blocking([&]() -> ValueAsync<bool> {
+        auto file = co_await Block::open(path, Block::F_READ | Block::F_WRITE | Block::F_CREAT | Block::F_TRUNC);
+        const auto result = co_await uses(file, [](Block &file) -> ValueAsync<bool> {
+            if (co_await file.allocate(0, 8192) != IO_OK || std::filesystem::file_size(path) != 8192) co_return false;
+            // space past the end without growing the file
+            if (co_await file.allocate(8192, 8192, Block::A_KEEP_SIZE) != IO_OK) co_return false;
+            if (std::filesystem::file_size(path) != 8192) co_return false;
+            // a range inside the file neither shrinks it nor touches its data
+            char data[16], in[16]{};
+            std::memset(data, 'x', 16);
+            if ((co_await file.write({data, 16}, 8000)).get_result() != 16) co_return false;
+            if (co_await file.allocate(0, 4096, Block::A_KEEP_SIZE) != IO_OK) co_return false;
+            if (co_await file.allocate(0, 4096) != IO_OK || std::filesystem::file_size(path) != 8192) co_return false;
+            if ((co_await file.read({in, 16}, 8000)).get_result() != 16 || std::memcmp(in, data, 16) != 0) co_return false;
+            // a length past 4 GiB stands for the rest of the file rather than being cut short
+            if (co_await file.advise(0, uint64_t(1) << 32, Block::ADVICE_SEQUENTIAL) != IO_OK) co_return false;
+            if (co_await file.advise(4096, 4096, Block::ADVICE_DONTNEED) != IO_OK) co_return false;
+            if (co_await file.truncate(100) != IO_OK || std::filesystem::file_size(path) != 100) co_return false;
+            co_return co_await file.truncate(0) == IO_OK && std::filesystem::file_size(path) == 0;
+        });
+        std::filesystem::remove_all(path);
+        co_return result;
+    });
+    ASSERT_TRUE(success);
+}
+
+#ifdef __linux__
+namespace {
+    // Not every file system takes direct I/O. The probe may create the file before refusing O_DIRECT,
+    //     so it is removed either way
+    bool direct_io(const char *path) {
+        const auto probe = ::open(path, O_RDWR | O_CREAT | O_DIRECT, 0644);
+        if (probe >= 0) ::close(probe);
+        std::filesystem::remove_all(path);
+        return probe >= 0;
+    }
+}
+
+TEST(kls_io, FileChain) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    static constexpr auto payload = std::string_view("Hello World\n");
+    static constexpr auto payload_size = payload.size() + 1;
+
+    auto success = run_blocking([&]() -> ValueAsync<bool> {
+        auto file = co_await Block::open("./test.kls.io.chain.temp", Block::F_READ | Block::F_WRITE | Block::F_CREAT);
+        const auto result = co_await uses(file, [](Block &file) -> ValueAsync<bool> {
+            char buffer[1000]{};
+            const auto [write, sync, read] = co_await chain(
+                    file.write_op({payload.data(), payload_size}, 0), file.sync_op(), file.read_op({buffer, 1000}, 0)
+            );
+            if (write.get_result() != payload_size || !sync.success()) co_return false;
+            if (read.get_result() != payload_size) co_return false;
+            co_return payload.compare(buffer) == 0;
+        });
+        std::filesystem::remove_all("./test.kls.io.chain.temp");
+        co_return result;
+    });
+    ASSERT_TRUE(success);
+}
+
+TEST(kls_io, FilePunchHole) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    static constexpr auto path = "./test.kls.io.punch.temp";
+
+    auto success = run_blocking([&]() -> ValueAsync<bool> {
+        auto file = co_await Block::open(path, Block::F_READ | Block::F_WRITE | Block::F_CREAT | Block::F_TRUNC);
+        const auto result = co_await uses(file, [](Block &file) -> ValueAsync<bool> {
+            char data[8192];
+            std::memset(data, 'x', 8192);
+            if ((co_await file.write({data, 8192}, 0)).get_result() != 8192) co_return false;
+            // not every file system deallocates, those that do not have nothing to check
+            if (const auto status = co_await file.allocate(0, 4096, Block::A_PUNCH_HOLE); status == IO_ENOTSUP)
+                co_return true;
+            else if (status != IO_OK) co_return false;
+            if (std::filesystem::file_size(path) != 8192) co_return false;
+            if ((co_await file.read({data, 8192}, 0)).get_result() != 8192) co_return false;
+            for (int i = 0; i < 8192; ++i) if (data[i] != (i < 4096 ? 0 : 'x')) co_return false;
+            co_return true;
+        });
+        std::filesystem::remove_all(path);
+        co_return result;
+    });
+    ASSERT_TRUE(success);
+}
+
+TEST(kls_io, FileSyncUnsupported) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    // a character device has nothing to flush, the errors of the kernel come back mapped
+    auto success = run_blocking([&]() -> ValueAsync<bool> {
+        auto file = co_await Block::open("/dev/null", Block::F_READ | Block::F_WRITE);
+        co_return co_await uses(file, [](Block &file) -> ValueAsync<bool> {
+            if (co_await file.sync_all() != IO_EINVAL) co_return false;
+            co_return co_await file.sync_range(0, 4096) == IO_ESPIPE;
+        });
+    });
+    ASSERT_TRUE(success);
+}
+
+TEST(kls_io, FileChainRefused) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    auto success = run_blocking([&]() -> ValueAsync<bool> {
+        auto file = co_await Block::open("./test.kls.io.refused.temp", Block::F_READ | Block::F_WRITE | Block::F_CREAT);
+        const auto result = co_await uses(file, [](Block &file) -> ValueAsync<bool> {
+            char buffer[16]{};
+            // the kernel takes 32 bit lengths, the chain is refused before anything reads past the buffer
+            const auto [write, sync] = co_await chain(file.write_op({buffer, size_t(1) << 32}, 0), file.sync_op());
+            co_return write.error() == IO_EINVAL && sync.error() == IO_EINVAL;
+        });
+        std::filesystem::remove_all("./test.kls.io.refused.temp");
+        co_return result;
+    });
+    ASSERT_TRUE(success);
+}
+
+TEST(kls_io, FileBatch) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    auto success = run_blocking([&]() -> ValueAsync<bool> {
+        auto file = co_await Block::open("./test.kls.io.batch.temp", Block::F_READ | Block::F_WRITE | Block::F_CREAT);
+        const auto result = co_await uses(file, [](Block &file) -> ValueAsync<bool> {
+            char data[4096];
+            for (int i = 0; i < 4096; ++i) data[i] = static_cast<char>(i * 13);
+            if ((co_await file.write({data, 4096}, 0)).get_result() != 4096) co_return false;
+            char first[16]{}, second[16]{}, third[16]{};
+            ReadRequest requests[]{
+                    {{first, 16}, 0},
+                    {{static_cast<char *>(nullptr), 16}, 16}, // faults
+                    {{second, 16}, 1000},
+                    {{third, 16}, uint64_t(1) << 63}, // an offset the kernel refuses
+                    {{third, 16}, 4090}, // cut short by the end of the file
+                    {{first, size_t(1) << 32}, 0} // longer than the kernel takes, refused before anything is read
+            };
+            // the status is the first error in the order of the requests
+            if (co_await file.read_batch({requests, 6}) != IO_EFAULT) co_return false;
+            if (requests[0].result.get_result() != 16 || std::memcmp(first, data, 16) != 0) co_return false;
+            if (requests[1].result.error() != IO_EFAULT) co_return false;
+            if (requests[2].result.get_result() != 16 || std::memcmp(second, data + 1000, 16) != 0) co_return false;
+            if (requests[3].result.error() != IO_EINVAL) co_return false;
+            if (requests[4].result.get_result() != 6 || std::memcmp(third, data + 4090, 6) != 0) co_return false;
+            co_return requests[5].result.error() == IO_EINVAL;
+        });
+        std::filesystem::remove_all("./test.kls.io.batch.temp");
+        co_return result;
+    });
+    ASSERT_TRUE(success);
+}
+
+TEST(kls_io, FileBatchDirect) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    static constexpr auto flags = Block::F_READ | Block::F_WRITE | Block::F_CREAT | Block::F_DIRECT;
+
+    if (!direct_io("./test.kls.io.direct.temp")) GTEST_SKIP() << "No direct I/O in the working directory";
+
+    auto success = run_blocking([&]() -> ValueAsync<bool> {
+        auto file = co_await Block::open("./test.kls.io.direct.temp", flags);
+        const auto result = co_await uses(file, [](Block &file) -> ValueAsync<bool> {
+            const auto align = file.alignment();
+            auto out = file.aligned_buffer(2 * align), in = file.aligned_buffer(2 * align);
+            const auto written = reinterpret_cast<char *>(out.data()), read = reinterpret_cast<char *>(in.data());
+            for (size_t i = 0; i < out.size(); ++i) written[i] = static_cast<char>(i * 7);
+            if ((co_await file.write(out.span(), 0)).get_result() != out.size()) co_return false;
+            // the misaligned request completes on the spot, the others still go to the kernel
+            ReadRequest requests[]{
+                    {{read, align}, 0},
+                    {{read + 1, align}, 0},
+                    {{read + align, align}, align}
+            };
+            if (co_await file.read_batch({requests, 3}) != IO_EINVAL) co_return false;
+            if (requests[0].result.get_result() != align || requests[2].result.get_result() != align) co_return false;
+            if (requests[1].result.error() != IO_EINVAL) co_return false;
+            co_return std::memcmp(read, written, 2 * align) == 0;
+        });
+        std::filesystem::remove_all("./test.kls.io.direct.temp");
+        co_return result;
+    });
+    ASSERT_TRUE(success);
+}
+
+TEST(kls_io, FileChainMisaligned) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    static constexpr auto flags = Block::F_READ | Block::F_WRITE | Block::F_CREAT | Block::F_DIRECT;
+
+    if (!direct_io("./test.kls.io.direct.chain.temp")) GTEST_SKIP() << "No direct I/O in the working directory";
+
+    auto success = run_blocking([&]() -> ValueAsync<bool> {
+        auto file = co_await Block::open("./test.kls.io.direct.chain.temp", flags);
+        const auto result = co_await uses(file, [](Block &file) -> ValueAsync<bool> {
+            const auto align = file.alignment();
+            auto buffer = file.aligned_buffer(2 * align);
+            const auto data = reinterpret_cast<char *>(buffer.data());
+            std::memset(data, 'x', buffer.size());
+            // the aligned write is refused along with the misaligned one, nothing reaches the file
+            const auto [write, misaligned, sync] = co_await chain(
+                    file.write_op({data, align}, 0), file.write_op({data + 1, align}, align), file.sync_op()
+            );
+            if (write.error() != IO_EINVAL || misaligned.error() != IO_EINVAL || sync.error() != IO_EINVAL)
+                co_return false;
+            co_return (co_await file.read({data, align}, 0)).get_result() == 0;
+        });
+        std::filesystem::remove_all("./test.kls.io.direct.chain.temp");
+        co_return result;
+    });
+    ASSERT_TRUE(success);
+}
+#endif
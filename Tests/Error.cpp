@@ -0,0 +1,46 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifdef __linux__
+#include <cerrno>
+#include <gtest/gtest.h>
+#include "kls/io/Await.h"
+
+TEST(kls_io, ErrorMapping) {
+    using namespace kls::io;
+
+    // completions carry negated errno values, system calls report positive ones, both map alike
+    ASSERT_EQ(detail::map_error(-ENOENT), IO_ENOENT);
+    ASSERT_EQ(detail::map_error(ENOENT), IO_ENOENT);
+    ASSERT_EQ(detail::map_error(-ECANCELED), IO_ECANCELED);
+    ASSERT_EQ(detail::map_error(-EINVAL), IO_EINVAL);
+    ASSERT_EQ(detail::map_error(0), IO_OK);
+    ASSERT_EQ(detail::map_error(-ENOTRECOVERABLE), IO_UNKNOWN);
+
+    const auto failed = detail::map_result(-EBADF);
+    ASSERT_FALSE(failed.success());
+    ASSERT_EQ(failed.error(), IO_EBADF);
+    const auto transferred = detail::map_result(42);
+    ASSERT_TRUE(transferred.success());
+    ASSERT_EQ(transferred.result(), 42);
+}
+#endif
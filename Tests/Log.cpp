@@ -0,0 +1,117 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifdef __linux__
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include "kls/io/Log.h"
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
+
+namespace {
+    struct Record {
+        uint64_t offset;
+        size_t size;
+        char tag;
+    };
+}
+
+TEST(kls_io, LogConcurrentAppends) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    static constexpr auto path = "./test.kls.io.log.temp";
+    static constexpr int threads = 4, appends = 50;
+
+    std::filesystem::remove_all(path);
+    auto log = run_blocking([]() -> ValueAsync<std::unique_ptr<AppendLog>> { co_return co_await append_log(path, 4096); });
+    // every record gets a tag of its own and a size of its own, so that misplaced data shows on reading back
+    std::vector<Record> records[threads];
+    std::vector<std::thread> workers{};
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&log, &records, t] {
+            run_blocking([&]() -> ValueAsync<void> {
+                for (int i = 0; i < appends; ++i) {
+                    const auto tag = static_cast<char>(t * appends + i);
+                    std::vector<char> data(static_cast<size_t>(1 + (t * 37 + i * 11) % 300), tag);
+                    const auto offset = co_await log->append({data.data(), data.size()});
+                    records[t].push_back(Record{offset, data.size(), tag});
+                }
+            });
+        });
+    }
+    for (auto &worker: workers) worker.join();
+    ASSERT_EQ(run_blocking([&]() -> ValueAsync<Status> { co_return co_await log->close(); }), IO_OK);
+
+    // the offsets cover the file from the start without gaps or overlaps
+    std::vector<Record> all{};
+    for (auto &some: records) all.insert(all.end(), some.begin(), some.end());
+    ASSERT_EQ(all.size(), size_t(threads * appends));
+    std::sort(all.begin(), all.end(), [](const Record &l, const Record &r) { return l.offset < r.offset; });
+    uint64_t end = 0;
+    for (const auto &record: all) {
+        ASSERT_EQ(record.offset, end);
+        end += record.size;
+    }
+    ASSERT_EQ(std::filesystem::file_size(path), end);
+
+    const auto success = run_blocking([&]() -> ValueAsync<bool> {
+        auto file = co_await Block::open(path, Block::F_READ);
+        const auto result = co_await uses(file, [&](Block &file) -> ValueAsync<bool> {
+            std::vector<char> data(end);
+            if ((co_await file.read({data.data(), data.size()}, 0)).get_result() != end) co_return false;
+            for (const auto &record: all)
+                for (size_t i = 0; i < record.size; ++i) if (data[record.offset + i] != record.tag) co_return false;
+            co_return true;
+        });
+        co_return result;
+    });
+    std::filesystem::remove_all(path);
+    ASSERT_TRUE(success);
+}
+
+TEST(kls_io, LogFailure) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    if (!std::filesystem::exists("/dev/full")) GTEST_SKIP() << "No /dev/full to fail writes on";
+
+    // every write to /dev/full fails with ENOSPC, after which the log turns every append down
+    const auto success = run_blocking([]() -> ValueAsync<bool> {
+        auto log = co_await append_log("/dev/full");
+        char data[16]{};
+        auto failed = 0;
+        for (int i = 0; i < 3; ++i) {
+            try { co_await log->append({data, 16}); }
+            catch (exception_errc &e) { if (e.errc == IO_ENOSPC) ++failed; }
+        }
+        co_await log->close();
+        co_return failed == 3;
+    });
+    ASSERT_TRUE(success);
+}
+#endif
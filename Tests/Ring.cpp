@@ -0,0 +1,427 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifdef __linux__
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <filesystem>
+#include <stop_token>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <gtest/gtest.h>
+#include "kls/io/Ring.h"
+#include "kls/io/TCP.h"
+#include "kls/io/Timer.h"
+#include "kls/io/Block.h"
+#include "kls/io/Buffer.h"
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
+
+namespace {
+    // The rings are configured once per process, so each configuration is tested in a process of its own.
+    // The threadsafe style runs the death test in a fresh instance of the test binary, which has no rings yet
+    template<class Fn>
+    void in_own_process(const kls::io::RingConfig &config, Fn body) {
+        testing::GTEST_FLAG(death_test_style) = "threadsafe";
+        EXPECT_EXIT({
+            kls::io::configure(config);
+            std::exit(body() ? 0 : 1);
+        }, testing::ExitedWithCode(0), "");
+    }
+
+    // Writes a file and reads it back
+    bool round_trip(const std::string &path) {
+        using namespace kls::io;
+        using namespace kls::essential;
+        using namespace kls::coroutine;
+
+        return run_blocking([&]() -> ValueAsync<bool> {
+            auto file = co_await Block::open(path, Block::F_READ | Block::F_WRITE | Block::F_CREAT | Block::F_TRUNC);
+            const auto result = co_await uses(file, [](Block &file) -> ValueAsync<bool> {
+                char out[64]{}, in[64]{};
+                for (int i = 0; i < 64; ++i) out[i] = static_cast<char>(i);
+                if ((co_await file.write({out, 64}, 0)).get_result() != 64) co_return false;
+                if ((co_await file.read({in, 64}, 0)).get_result() != 64) co_return false;
+                co_return std::memcmp(in, out, 64) == 0;
+            });
+            std::filesystem::remove_all(path);
+            co_return result;
+        });
+    }
+
+    // Whether the kernel sets up a polled ring for this process, and a second one sharing its poller.
+    // Before Linux 5.11 polling takes privileges, and sandboxes may refuse io_uring_setup altogether
+    bool sq_poll_available(bool attach) {
+        io_uring_params params{};
+        params.flags = IORING_SETUP_SQPOLL;
+        const auto first = static_cast<int>(syscall(__NR_io_uring_setup, 4, &params));
+        if (first < 0) return false;
+        auto result = true;
+        if (attach) {
+            io_uring_params second{};
+            second.flags = IORING_SETUP_SQPOLL | IORING_SETUP_ATTACH_WQ;
+            second.wq_fd = static_cast<uint32_t>(first);
+            const auto fd = static_cast<int>(syscall(__NR_io_uring_setup, 4, &second));
+            if (fd >= 0) close(fd); else result = false;
+        }
+        close(first);
+        return result;
+    }
+
+    // Starts `count` reads back to back before awaiting any of them, so that their completions arrive in bursts,
+    //     and checks that every await resumes with its own result. Each read is one byte longer than the last
+    bool burst(const std::string &path, int count) {
+        using namespace kls::io;
+        using namespace kls::essential;
+        using namespace kls::coroutine;
+
+        return run_blocking([&]() -> ValueAsync<bool> {
+            auto file = co_await Block::open(path, Block::F_READ | Block::F_WRITE | Block::F_CREAT | Block::F_TRUNC);
+            const auto result = co_await uses(file, [count](Block &file) -> ValueAsync<bool> {
+                const auto size = static_cast<size_t>(count) * 16;
+                std::vector<char> out(size), in(size);
+                for (size_t i = 0; i < size; ++i) out[i] = static_cast<char>(i * 7);
+                if ((co_await file.write({out.data(), size}, 0)).get_result() != size) co_return false;
+                // the await is the user data of its operation, so it is built in place and never moves
+                struct Pending {
+                    IOAwait<IOResult> read;
+                    Pending(Block &file, char *at, size_t length, uint64_t offset): read(file.read({at, length}, offset)) {}
+                };
+                std::vector<std::optional<Pending>> reads(static_cast<size_t>(count));
+                for (int i = 0; i < count; ++i) reads[i].emplace(file, in.data() + i * 16, 1 + i % 16, uint64_t(i) * 16);
+                for (int i = 0; i < count; ++i) {
+                    if ((co_await reads[i]->read).get_result() != 1 + i % 16) co_return false;
+                    if (std::memcmp(in.data() + i * 16, out.data() + i * 16, 1 + i % 16) != 0) co_return false;
+                }
+                co_return true;
+            });
+            std::filesystem::remove_all(path);
+            co_return result;
+        });
+    }
+}
+
+TEST(kls_io, RingPerThread) {
+    using namespace kls::io;
+
+    in_own_process(RingConfig{.per_thread = true}, [] {
+        std::atomic_int done{0};
+        // the second wave picks up the rings the first one handed back
+        for (int wave = 0; wave < 2; ++wave) {
+            std::vector<std::thread> threads{};
+            for (int i = 0; i < 4; ++i) {
+                threads.emplace_back([i, &done] {
+                    const auto path = "./test.kls.io.ring." + std::to_string(i) + ".temp";
+                    for (int j = 0; j < 16; ++j) if (round_trip(path)) ++done;
+                });
+            }
+            for (auto &thread: threads) thread.join();
+        }
+        return done == 2 * 4 * 16;
+    });
+}
+
+TEST(kls_io, RingDeferred) {
+    using namespace kls::io;
+
+    // a single operation is far below the batch, it has to go out once its coroutine suspends
+    in_own_process(RingConfig{.deferred_submit = true, .submit_batch = 64}, [] {
+        for (int i = 0; i < 16; ++i) if (!round_trip("./test.kls.io.deferred.temp")) return false;
+        return true;
+    });
+}
+
+TEST(kls_io, RingShortQueue) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    in_own_process(RingConfig{.sq_entries = 4}, [] {
+        return run_blocking([]() -> ValueAsync<bool> {
+            const auto path = "./test.kls.io.short.temp";
+            auto file = co_await Block::open(path, Block::F_READ | Block::F_WRITE | Block::F_CREAT | Block::F_TRUNC);
+            const auto result = co_await uses(file, [](Block &file) -> ValueAsync<bool> {
+                char data[5]{'a', 'b', 'c', 'd', 'e'};
+                // one more than fits the submission queue, waiting for room would never end
+                const auto results = co_await chain(
+                        file.write_op({data, 1}, 0), file.write_op({data + 1, 1}, 1), file.write_op({data + 2, 1}, 2),
+                        file.write_op({data + 3, 1}, 3), file.write_op({data + 4, 1}, 4)
+                );
+                for (const auto &result: results) if (result.error() != IO_EINVAL) co_return false;
+                // a chain that fits still goes through
+                const auto [write, sync] = co_await chain(file.write_op({data, 5}, 0), file.sync_op());
+                co_return write.get_result() == 5 && sync.success();
+            });
+            std::filesystem::remove_all(path);
+            co_return result;
+        });
+    });
+}
+
+TEST(kls_io, RingBatchPastQueue) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    // a batch is not linked, so it may be split over several submissions when the queue is too short for it
+    in_own_process(RingConfig{.sq_entries = 4}, [] {
+        return run_blocking([]() -> ValueAsync<bool> {
+            const auto path = "./test.kls.io.batch.short.temp";
+            auto file = co_await Block::open(path, Block::F_READ | Block::F_WRITE | Block::F_CREAT | Block::F_TRUNC);
+            const auto result = co_await uses(file, [](Block &file) -> ValueAsync<bool> {
+                char data[160], in[160]{};
+                for (int i = 0; i < 160; ++i) data[i] = static_cast<char>(i);
+                if ((co_await file.write({data, 160}, 0)).get_result() != 160) co_return false;
+                std::vector<ReadRequest> requests{};
+                for (int i = 0; i < 10; ++i) requests.push_back(ReadRequest{{in + i * 16, 16}, uint64_t(i) * 16});
+                if (co_await file.read_batch({requests.data(), requests.size()}) != IO_OK) co_return false;
+                for (auto &request: requests) if (request.result.get_result() != 16) co_return false;
+                co_return std::memcmp(in, data, 160) == 0;
+            });
+            std::filesystem::remove_all(path);
+            co_return result;
+        });
+    });
+}
+
+TEST(kls_io, RingSingleIssuerCancel) {
+    using namespace kls::io;
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+
+    // a thread that does not own the ring cannot submit to it, its cancel waits in the mailbox of the ring
+    //     until the owner submits again, which the ticking coroutine does
+    in_own_process(RingConfig{.per_thread = true, .single_issuer = true}, [] {
+        return run_blocking([]() -> ValueAsync<bool> {
+            std::stop_source stop{};
+            std::atomic_bool done{false};
+            Status slept{IO_OK};
+            std::thread canceller{[&stop] {
+                std::this_thread::sleep_for(50ms);
+                stop.request_stop();
+            }};
+            auto Sleep = [&]() -> ValueAsync<void> {
+                slept = co_await cancellable(sleep_for(10s), stop.get_token());
+                done = true;
+            };
+            auto Tick = [&]() -> ValueAsync<void> {
+                for (int i = 0; i < 500 && !done; ++i) co_await sleep_for(10ms);
+            };
+            co_await awaits(Sleep(), Tick());
+            canceller.join();
+            co_return slept == IO_ECANCELED;
+        });
+    });
+}
+
+TEST(kls_io, RingSingleIssuerForeignReceive) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    // the buffer group lives on a ring only its creator may submit to, so a receive from another thread
+    //     has to fail instead of being refused by the kernel with nothing left to resume it
+    in_own_process(RingConfig{.per_thread = true, .single_issuer = true}, [] {
+        return run_blocking([]() -> ValueAsync<bool> {
+            auto buffers = buffer_ring(2, 64);
+            bool refused{false};
+            auto Accept = [&]() -> ValueAsync<void> {
+                auto accept = acceptor_tcp(Address::CreateIPv4("0.0.0.0").value(), 30091, 128);
+                co_await uses(accept, [&](AcceptorTCP &accept) -> ValueAsync<void> {
+                    auto &&[address, stream] = co_await accept.once();
+                    co_await uses(stream, [&](SocketTCP &conn) -> ValueAsync<void> {
+                        std::thread other{[&] {
+                            const auto select = run_blocking([&]() -> ValueAsync<bool> {
+                                co_return (co_await conn.recv_select(*buffers)).result.error() == IO_EEXIST;
+                            });
+                            auto stream = conn.recv_stream(*buffers);
+                            const auto streamed = run_blocking([&]() -> ValueAsync<bool> {
+                                const auto received = co_await stream.next();
+                                co_return received.result.error() == IO_EEXIST;
+                            });
+                            refused = select && streamed;
+                        }};
+                        other.join();
+                    });
+                });
+            };
+            auto Connect = [&]() -> ValueAsync<void> {
+                auto conn = co_await connect(Address::CreateIPv4("127.0.0.1").value(), 30091);
+                co_await uses(conn, [](SocketTCP &) -> ValueAsync<void> { co_return; });
+            };
+            co_await awaits(Accept(), Connect());
+            co_return refused;
+        });
+    });
+}
+
+TEST(kls_io, RingCompletionQueue) {
+    using namespace kls::io;
+
+    // far more completions than the submission queue holds, all of which the completion queue takes without
+    //     spilling into the kernel backlog
+    in_own_process(RingConfig{.sq_entries = 16, .cq_entries = 256}, [] {
+        return burst("./test.kls.io.cq.temp", 200);
+    });
+}
+
+TEST(kls_io, RingCoopTaskrun) {
+    using namespace kls::io;
+
+    in_own_process(RingConfig{.coop_taskrun = true}, [] {
+        for (int i = 0; i < 4; ++i) if (!round_trip("./test.kls.io.coop.temp")) return false;
+        return burst("./test.kls.io.coop.temp", 64);
+    });
+}
+
+TEST(kls_io, RingConfigRejected) {
+    using namespace kls::io;
+
+    // refused configurations leave the one in place, which only sticks once the first operation starts
+    in_own_process(RingConfig{}, [] {
+        const auto rejected = [](const RingConfig &config, Status expected) {
+            try {
+                configure(config);
+                return false;
+            }
+            catch (exception_errc &e) { return e.errc == expected; }
+        };
+        if (!rejected(RingConfig{.sq_entries = 1}, IO_EINVAL)) return false;
+        if (!rejected(RingConfig{.sq_entries = 64, .cq_entries = 32}, IO_EINVAL)) return false;
+        if (!rejected(RingConfig{.single_issuer = true}, IO_EINVAL)) return false;
+        if (!rejected(RingConfig{.per_thread = true, .single_issuer = true, .fixed_buffers = 4}, IO_EINVAL)) return false;
+        if (!rejected(RingConfig{.per_thread = true, .single_issuer = true, .fixed_files = 4}, IO_EINVAL)) return false;
+        if (!round_trip("./test.kls.io.rejected.temp")) return false;
+        return rejected(RingConfig{}, IO_EBUSY);
+    });
+}
+
+TEST(kls_io, RingSingleIssuer) {
+    using namespace kls::io;
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+
+    // the owner submits and cancels on its own ring
+    in_own_process(RingConfig{.per_thread = true, .single_issuer = true}, [] {
+        if (!round_trip("./test.kls.io.single.temp")) return false;
+        return run_blocking([]() -> ValueAsync<bool> {
+            std::stop_source stop{};
+            Status slept{IO_OK};
+            auto Sleep = [&]() -> ValueAsync<void> { slept = co_await cancellable(sleep_for(10s), stop.get_token()); };
+            auto Stop = [&]() -> ValueAsync<void> {
+                co_await sleep_for(20ms);
+                stop.request_stop();
+            };
+            co_await awaits(Sleep(), Stop());
+            co_return slept == IO_ECANCELED;
+        });
+    });
+}
+
+TEST(kls_io, RingSqPoll) {
+    using namespace kls::io;
+
+    if (!sq_poll_available(false)) GTEST_SKIP() << "The kernel refuses polled rings to this process";
+    // a short idle time lets the poller fall asleep between the round trips, which then have to wake it
+    in_own_process(RingConfig{.sq_poll = true, .sq_poll_idle = 10}, [] {
+        for (int i = 0; i < 4; ++i) {
+            if (!round_trip("./test.kls.io.sqpoll.temp")) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        return burst("./test.kls.io.sqpoll.temp", 64);
+    });
+}
+
+TEST(kls_io, RingSqPollPerThread) {
+    using namespace kls::io;
+
+    if (!sq_poll_available(true)) GTEST_SKIP() << "The kernel refuses polled rings sharing a poller to this process";
+    // the rings of the threads attach to the poller of the first ring
+    in_own_process(RingConfig{.per_thread = true, .sq_poll = true}, [] {
+        std::atomic_int done{0};
+        std::vector<std::thread> threads{};
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([i, &done] {
+                const auto path = "./test.kls.io.sqpoll." + std::to_string(i) + ".temp";
+                for (int j = 0; j < 8; ++j) if (round_trip(path)) ++done;
+            });
+        }
+        for (auto &thread: threads) thread.join();
+        return done == 4 * 8;
+    });
+}
+
+TEST(kls_io, RingReapBatch) {
+    using namespace kls::io;
+
+    // deferred submission sends the whole burst with one system call, so the completions land together
+    //     and are taken off the queue four at a time, many batches over
+    in_own_process(RingConfig{.deferred_submit = true, .submit_batch = 256, .reap_batch = 4}, [] {
+        return burst("./test.kls.io.reap.temp", 128);
+    });
+}
+
+TEST(kls_io, RingFixedBuffers) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    in_own_process(RingConfig{.fixed_buffers = 8}, [] {
+        return run_blocking([]() -> ValueAsync<bool> {
+            auto pool = fixed_buffer_pool(4, 4096);
+            std::vector<FixedBuffer> held{};
+            while (auto buffer = pool->acquire()) held.push_back(*buffer);
+            if (held.size() != 4) co_return false;
+            // the remaining slots cannot fit another pool of this size
+            try {
+                auto more = fixed_buffer_pool(8, 4096);
+                co_return false;
+            }
+            catch (exception_errc &e) { if (e.errc != IO_ENOBUFS) co_return false; }
+
+            const auto path = "./test.kls.io.fixed.temp";
+            auto file = co_await Block::open(path, Block::F_READ | Block::F_WRITE | Block::F_CREAT | Block::F_TRUNC);
+            const auto result = co_await uses(file, [&held](Block &file) -> ValueAsync<bool> {
+                auto out = held[0], in = held[1];
+                const auto written = reinterpret_cast<std::byte *>(out.span.data());
+                const auto read = reinterpret_cast<std::byte *>(in.span.data()) + 1024;
+                for (size_t i = 0; i < 4096; ++i) written[i] = static_cast<std::byte>(i * 7);
+                if ((co_await file.write_fixed(out, 0)).get_result() != 4096) co_return false;
+                // a narrowed span still refers to the same registered buffer
+                in.span = Span<>(read, 1024);
+                if ((co_await file.read_fixed(in, 1024)).get_result() != 1024) co_return false;
+                co_return std::memcmp(read, written + 1024, 1024) == 0;
+            });
+            std::filesystem::remove_all(path);
+            for (auto &buffer: held) pool->release(buffer);
+            co_return result && pool->acquire().has_value();
+        });
+    });
+}
+#endif
@@ -20,10 +20,20 @@
 * SOFTWARE.
 */
 
+#include <atomic>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <string_view>
+#include <stop_token>
 #include <gtest/gtest.h>
 #include "kls/io/TCP.h"
 #include "kls/coroutine/Blocking.h"
 #include "kls/coroutine/Operation.h"
+#ifdef __linux__
+#include "kls/io/Timer.h"
+#endif
 
 TEST(kls_io, TcpEcho) {
     using namespace kls::io;
@@ -58,4 +68,375 @@ TEST(kls_io, TcpEcho) {
     run_blocking([&]() -> ValueAsync<void> {
         co_await kls::coroutine::awaits(ServerOnceEcho(), ClientOnce());
     });
-}
\ No newline at end of file
+}
+
+TEST(kls_io, TcpSendFile) {
+    using namespace kls::io;
+    using namespace kls::essential;
+    using namespace kls::coroutine;
+
+    static constexpr auto path = "./test.kls.io.sendfile.temp";
+    static constexpr size_t size = 200000, from = 1000, length = 150000;
+
+    std::vector<char> data(size);
+    for (size_t i = 0; i < size; ++i) data[i] = static_cast<char>(i * 31 + i / 256);
+    bool sent = false, received = false;
+
+    auto Serve = [&]() -> ValueAsync<void> {
+        auto accept = acceptor_tcp(Address::CreateIPv4("0.0.0.0").value(), 30090, 128);
+        co_await uses(accept, [&](AcceptorTCP &accept) -> ValueAsync<void> {
+            auto &&[address, stream] = co_await accept.once();
+            co_await uses(stream, [&](SocketTCP &conn) -> ValueAsync<void> {
+                auto file = co_await Block::open(path, Block::F_READ | Block::F_WRITE | Block::F_CREAT | Block::F_TRUNC);
+                co_await uses(file, [&](Block &file) -> ValueAsync<void> {
+                    if ((co_await file.write({data.data(), size}, 0)).get_result() != size) co_return;
+                    if (co_await send_file(conn, file, from, length) != IO_OK) co_return;
+                    // a range running past the end of the file
+                    sent = co_await send_file(conn, file, size - 10, 100) == IO_EIO;
+                });
+            });
+        });
+    };
+
+    auto Receive = [&]() -> ValueAsync<void> {
+        auto file = co_await connect(Address::CreateIPv4("127.0.0.1").value(), 30090);
+        co_await uses(file, [&](SocketTCP &conn) -> ValueAsync<void> {
+            std::vector<char> in(length);
+            for (size_t done = 0; done < length;) {
+                const auto res = co_await conn.read({in.data() + done, length - done});
+                if (!res.success() || !res.result()) co_return;
+                done += static_cast<size_t>(res.result());
+            }
+            received = std::equal(in.begin(), in.end(), data.begin() + from);
+        });
+    };
+
+    run_blocking([&]() -> ValueAsync<void> { co_await kls::coroutine::awaits(Serve(), Receive()); });
+    std::filesystem::remove_all(path);
+    ASSERT_TRUE(sent);
+    ASSERT_TRUE(received);
+}
+
+#ifdef __linux__
+TEST(kls_io, TcpAcceptTimeout) {
+    using namespace kls::io;
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+
+    run_blocking([&]() -> ValueAsync<void> {
+        auto accept = acceptor_tcp(Address::CreateIPv4("0.0.0.0").value(), 30081, 128);
+        co_await uses(accept, [](AcceptorTCP &accept) -> ValueAsync<void> {
+            try {
+                co_await accept.once(50ms);
+                ADD_FAILURE() << "Accept without a peer did not time out";
+            }
+            catch (exception_errc &e) { EXPECT_EQ(e.errc, IO_ETIMEDOUT); }
+        });
+    });
+}
+
+namespace {
+    // Runs `server` on the first connection accepted on `port` alongside `client` on a connection to it
+    template<class Server, class Client>
+    void over_loopback(int port, Server server, Client client) {
+        using namespace kls::io;
+        using namespace kls::coroutine;
+
+        auto Accept = [&]() -> ValueAsync<void> {
+            auto accept = acceptor_tcp(Address::CreateIPv4("0.0.0.0").value(), port, 128);
+            co_await uses(accept, [&](AcceptorTCP &accept) -> ValueAsync<void> {
+                auto &&[address, stream] = co_await accept.once();
+                co_await uses(stream, server);
+            });
+        };
+
+        auto Connect = [&]() -> ValueAsync<void> {
+            auto conn = co_await connect(Address::CreateIPv4("127.0.0.1").value(), port);
+            co_await uses(conn, client);
+        };
+
+        run_blocking([&]() -> ValueAsync<void> { co_await kls::coroutine::awaits(Accept(), Connect()); });
+    }
+
+    std::string_view text(kls::Span<> data) {
+        return {reinterpret_cast<const char *>(data.data()), data.size()};
+    }
+
+    // Sends each message and waits for the peer to acknowledge it, so that every message arrives on its own
+    kls::coroutine::ValueAsync<void> send_each(kls::io::SocketTCP &conn, std::vector<std::string> messages) {
+        char ack{};
+        for (auto &message: messages) {
+            if ((co_await conn.write({message.data(), message.size()})).get_result() != message.size()) co_return;
+            if ((co_await conn.read({&ack, 1})).get_result() != 1) co_return;
+        }
+    }
+
+    kls::coroutine::ValueAsync<void> acknowledge(kls::io::SocketTCP &conn) {
+        char ack{1};
+        co_await conn.write({&ack, 1});
+    }
+}
+
+TEST(kls_io, TcpRecvSelect) {
+    using namespace kls::io;
+    using namespace kls::coroutine;
+
+    over_loopback(30082, [](SocketTCP &conn) -> ValueAsync<void> {
+        auto buffers = buffer_ring(2, 64);
+        auto first = co_await conn.recv_select(*buffers);
+        EXPECT_EQ(text(first.buffer.data()), "first");
+        co_await acknowledge(conn);
+        auto second = co_await conn.recv_select(*buffers);
+        EXPECT_EQ(text(second.buffer.data()), "second");
+        co_await acknowledge(conn);
+        // both buffers are leased out, the data stays in the socket
+        auto third = co_await conn.recv_select(*buffers);
+        EXPECT_FALSE(third.result.success());
+        EXPECT_EQ(third.result.error(), IO_ENOBUFS);
+        EXPECT_FALSE(third.buffer);
+        // the lease hands its buffer back to the ring, where the next receive picks it up again
+        const auto recycled = first.buffer.data().data();
+        first.buffer.reset();
+        EXPECT_FALSE(first.buffer);
+        auto fourth = co_await conn.recv_select(*buffers);
+        EXPECT_EQ(text(fourth.buffer.data()), "third");
+        EXPECT_EQ(fourth.buffer.data().data(), recycled);
+        co_await acknowledge(conn);
+    }, [](SocketTCP &conn) -> ValueAsync<void> {
+        co_await send_each(conn, {"first", "second", "third"});
+    });
+}
+
+TEST(kls_io, TcpRecvStream) {
+    using namespace kls::io;
+    using namespace kls::coroutine;
+
+    std::vector<std::string> sent{};
+    for (int i = 0; i < 16; ++i) sent.push_back("message " + std::to_string(i));
+
+    // 16 messages through 4 buffers, which only works out if consumed leases go back to the ring
+    over_loopback(30083, [&sent](SocketTCP &conn) -> ValueAsync<void> {
+        auto buffers = buffer_ring(4, 64);
+        std::string received{};
+        auto stream = conn.recv_stream(*buffers);
+        for (;;) {
+            auto [result, buffer] = co_await stream.next();
+            EXPECT_TRUE(result.success());
+            if (!result.success() || result.get_result() == 0) break;
+            received += text(buffer.data());
+            co_await acknowledge(conn);
+        }
+        std::string expected{};
+        for (auto &message: sent) expected += message;
+        EXPECT_EQ(received, expected);
+        // the stream has ended with the connection
+        EXPECT_EQ((co_await stream.next()).result.error(), IO_ECANCELED);
+    }, [&sent](SocketTCP &conn) -> ValueAsync<void> { co_await send_each(conn, sent); });
+}
+
+TEST(kls_io, TcpRecvStreamDrop) {
+    using namespace kls::io;
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+
+    over_loopback(30084, [](SocketTCP &conn) -> ValueAsync<void> {
+        auto buffers = buffer_ring(2, 64);
+        {
+            auto stream = conn.recv_stream(*buffers);
+            auto first = co_await stream.next();
+            EXPECT_EQ(text(first.buffer.data()), "first");
+            co_await acknowledge(conn);
+            // the second message lands in a buffer queued on the stream, which is dropped without consuming it
+            co_await sleep_for(100ms);
+        }
+        // the buffers come back once the final completion of the cancelled receive has arrived
+        co_await sleep_for(20ms);
+        co_await acknowledge(conn);
+        // both buffers have to be back for two leases to be held at once
+        auto third = co_await conn.recv_select(*buffers);
+        EXPECT_TRUE(third.buffer);
+        co_await acknowledge(conn);
+        auto fourth = co_await conn.recv_select(*buffers);
+        EXPECT_TRUE(fourth.buffer);
+        co_await acknowledge(conn);
+    }, [](SocketTCP &conn) -> ValueAsync<void> {
+        co_await send_each(conn, {"first", "second", "third", "fourth"});
+    });
+}
+
+TEST(kls_io, TcpAcceptStream) {
+    using namespace kls::io;
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+
+    static constexpr int early = 6, late = 2;
+    auto hang_up = [](SocketTCP &) -> ValueAsync<void> { co_return; };
+
+    auto Server = [&]() -> ValueAsync<void> {
+        auto accept = acceptor_tcp(Address::CreateIPv4("0.0.0.0").value(), 30085, 128);
+        co_await uses(accept, [&](AcceptorTCP &accept) -> ValueAsync<void> {
+            auto stream = accept.stream(2);
+            // let the early connections overrun the backlog of the stream, which pauses accepting,
+            //     then the stream has to resume on its own for the late ones
+            co_await sleep_for(100ms);
+            for (int i = 0; i < early + late; ++i) {
+                auto &&[peer, conn] = co_await stream->next();
+                co_await uses(conn, hang_up);
+            }
+        });
+    };
+
+    auto Client = [&]() -> ValueAsync<void> {
+        for (int i = 0; i < early; ++i) {
+            auto conn = co_await connect(Address::CreateIPv4("127.0.0.1").value(), 30085);
+            co_await uses(conn, hang_up);
+        }
+        co_await sleep_for(200ms);
+        for (int i = 0; i < late; ++i) {
+            auto conn = co_await connect(Address::CreateIPv4("127.0.0.1").value(), 30085);
+            co_await uses(conn, hang_up);
+        }
+    };
+
+    run_blocking([&]() -> ValueAsync<void> { co_await kls::coroutine::awaits(Server(), Client()); });
+}
+
+TEST(kls_io, TcpZeroCopy) {
+    using namespace kls::io;
+    using namespace kls::coroutine;
+
+    // above and below the threshold, so that both the zero copy path with its extra notification
+    //     completion and the plain copy are taken
+    std::string large(2 * SocketTCP::zero_copy_threshold, '\0'), small(100, '\0');
+    for (size_t i = 0; i < large.size(); ++i) large[i] = static_cast<char>('a' + i % 26);
+    for (size_t i = 0; i < small.size(); ++i) small[i] = static_cast<char>('A' + i % 26);
+
+    over_loopback(30088, [&](SocketTCP &conn) -> ValueAsync<void> {
+        std::string received{};
+        char buffer[4096];
+        for (;;) {
+            const auto result = co_await conn.read({buffer, sizeof(buffer)});
+            if (!result.success() || result.get_result() == 0) break;
+            received.append(buffer, result.get_result());
+        }
+        EXPECT_EQ(received, large + small + large + small);
+    }, [&](SocketTCP &conn) -> ValueAsync<void> {
+        // A send may only resume once the kernel is done reading the buffer, so whatever it sent is scribbled
+        //     over right away. Had it resumed on the first completion rather than the notification, the kernel
+        //     could still be reading pages that now hold garbage, which would show up at the peer
+        const auto scribble = [](std::string &data, size_t from, size_t to) { std::fill(&data[from], &data[to], '#'); };
+        // a send to a stream socket may be cut short, what is left goes out with another send
+        auto send = [&conn, &scribble](std::string data, size_t sent) -> ValueAsync<bool> {
+            while (sent < data.size()) {
+                const auto result = co_await conn.send_zc({data.data() + sent, data.size() - sent});
+                if (!result.success() || result.get_result() == 0) co_return false;
+                scribble(data, sent, sent + result.get_result());
+                sent += result.get_result();
+            }
+            co_return true;
+        };
+        auto send_vector = [&conn, &send, &scribble](std::string data) -> ValueAsync<bool> {
+            const auto half = data.size() / 2;
+            IoVec vec[]{{data.data(), half}, {data.data() + half, data.size() - half}};
+            const auto result = co_await conn.sendmsg_zc({vec, 2});
+            if (!result.success()) co_return false;
+            const auto sent = static_cast<size_t>(result.get_result());
+            scribble(data, 0, sent);
+            co_return co_await send(std::move(data), sent);
+        };
+        EXPECT_TRUE(co_await send(large, 0));
+        EXPECT_TRUE(co_await send(small, 0));
+        EXPECT_TRUE(co_await send_vector(large));
+        EXPECT_TRUE(co_await send_vector(small));
+    });
+}
+
+TEST(kls_io, TcpCancel) {
+    using namespace kls::io;
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+
+    over_loopback(30089, [](SocketTCP &conn) -> ValueAsync<void> {
+        char buffer[16];
+        std::stop_source stop{};
+        auto Read = [&]() -> ValueAsync<void> {
+            const auto result = co_await cancellable(conn.read({buffer, sizeof(buffer)}), stop.get_token());
+            EXPECT_EQ(result.error(), IO_ECANCELED);
+        };
+        auto Stop = [&]() -> ValueAsync<void> {
+            co_await sleep_for(50ms);
+            stop.request_stop();
+        };
+        co_await kls::coroutine::awaits(Read(), Stop());
+
+        auto ReadAgain = [&]() -> ValueAsync<void> {
+            const auto result = co_await conn.read({buffer, sizeof(buffer)});
+            EXPECT_EQ(result.error(), IO_ECANCELED);
+        };
+        auto Cancel = [&]() -> ValueAsync<void> {
+            co_await sleep_for(50ms);
+            conn.cancel();
+        };
+        co_await kls::coroutine::awaits(ReadAgain(), Cancel());
+
+        // only the operations were cancelled, the connection goes on
+        co_await acknowledge(conn);
+        const auto result = co_await conn.read({buffer, sizeof(buffer)});
+        EXPECT_EQ(std::string_view(buffer, result.get_result()), "after");
+        co_await acknowledge(conn);
+    }, [](SocketTCP &conn) -> ValueAsync<void> {
+        char ack{};
+        co_await conn.read({&ack, 1});
+        co_await send_each(conn, {"after"});
+    });
+}
+
+namespace {
+    // Every connection made to the port has to be accepted by exactly one of the shards
+    void accept_sharded(int port, bool steer) {
+        using namespace kls::io;
+        using namespace kls::coroutine;
+        using namespace std::chrono_literals;
+
+        static constexpr int connections = 32;
+        auto hang_up = [](SocketTCP &) -> ValueAsync<void> { co_return; };
+        auto shards = acceptor_tcp_sharded(Address::CreateIPv4("0.0.0.0").value(), port, 128, 4, steer);
+        ASSERT_EQ(shards.size(), 4u);
+        std::atomic_int accepted{0};
+
+        // each shard takes what lands on it until things have gone quiet
+        auto Shard = [&](AcceptorTCP &accept) -> ValueAsync<void> {
+            for (;;) {
+                try {
+                    auto &&[peer, conn] = co_await accept.once(300ms);
+                    ++accepted;
+                    co_await uses(conn, hang_up);
+                }
+                catch (exception_errc &e) {
+                    EXPECT_EQ(e.errc, IO_ETIMEDOUT);
+                    co_return;
+                }
+            }
+        };
+
+        auto Client = [&]() -> ValueAsync<void> {
+            for (int i = 0; i < connections; ++i) {
+                auto conn = co_await connect(Address::CreateIPv4("127.0.0.1").value(), port);
+                co_await uses(conn, hang_up);
+            }
+        };
+
+        run_blocking([&]() -> ValueAsync<void> {
+            co_await kls::coroutine::awaits(
+                    Shard(*shards[0]), Shard(*shards[1]), Shard(*shards[2]), Shard(*shards[3]), Client()
+            );
+            for (auto &shard: shards) co_await shard->close();
+        });
+        EXPECT_EQ(accepted.load(), connections);
+    }
+}
+
+TEST(kls_io, TcpAcceptSharded) { accept_sharded(30086, false); }
+
+TEST(kls_io, TcpAcceptShardedSteered) { accept_sharded(30087, true); }
+#endif
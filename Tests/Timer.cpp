@@ -0,0 +1,71 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifdef __linux__
+#include <chrono>
+#include <gtest/gtest.h>
+#include "kls/io/Timer.h"
+#include "kls/coroutine/Blocking.h"
+
+TEST(kls_io, TimerTicks) {
+    using namespace kls::io;
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto success = run_blocking([]() -> ValueAsync<bool> {
+        auto ticks = timer(20ms);
+        for (int i = 0; i < 5; ++i) if (co_await ticks->next() != IO_OK) co_return false;
+        co_return true;
+    });
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    ASSERT_TRUE(success);
+    // five periods at the least, and nowhere near what a stuck timer would take
+    ASSERT_GE(elapsed, 100ms);
+    ASSERT_LT(elapsed, 5s);
+}
+
+TEST(kls_io, TimerSleepUntilPast) {
+    using namespace kls::io;
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+
+    // a deadline already behind us completes at once instead of waiting for the clock to come round
+    const auto start = std::chrono::steady_clock::now();
+    const auto success = run_blocking([]() -> ValueAsync<bool> {
+        if (co_await sleep_until(std::chrono::steady_clock::now() - 1s) != IO_OK) co_return false;
+        co_return co_await sleep_until(std::chrono::system_clock::now() - 1h) == IO_OK;
+    });
+    ASSERT_TRUE(success);
+    ASSERT_LT(std::chrono::steady_clock::now() - start, 1s);
+}
+
+TEST(kls_io, TimerSleepFor) {
+    using namespace kls::io;
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+
+    const auto start = std::chrono::steady_clock::now();
+    ASSERT_EQ(run_blocking([]() -> ValueAsync<Status> { co_return co_await sleep_for(30ms); }), IO_OK);
+    ASSERT_GE(std::chrono::steady_clock::now() - start, 30ms);
+}
+#endif
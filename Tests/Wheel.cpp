@@ -0,0 +1,99 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#ifdef __linux__
+#include <vector>
+#include <memory>
+#include <gtest/gtest.h>
+#include "kls/io/Wheel.h"
+#include "kls/io/Timer.h"
+#include "kls/coroutine/Blocking.h"
+
+namespace {
+    struct CountingEntry : kls::io::WheelEntry {
+        int fired{0};
+    protected:
+        void expired() noexcept override { ++fired; }
+    };
+}
+
+TEST(kls_io, TimerWheelExpiry) {
+    using namespace kls::io;
+    using namespace std::chrono_literals;
+
+    const auto start = std::chrono::steady_clock::now();
+    TimerWheel wheel{1ms};
+    CountingEntry near{}, far{}, cancelled{};
+    wheel.arm(near, 10ms);
+    wheel.arm(far, 100s); // three levels up
+    wheel.arm(cancelled, 10ms);
+    wheel.cancel(cancelled);
+    wheel.advance(start + 20ms);
+    EXPECT_EQ(near.fired, 1);
+    EXPECT_EQ(far.fired, 0);
+    wheel.advance(start + 99s);
+    EXPECT_EQ(far.fired, 0);
+    wheel.advance(start + 101s);
+    EXPECT_EQ(far.fired, 1);
+    EXPECT_EQ(cancelled.fired, 0);
+    EXPECT_FALSE(far.armed());
+}
+
+// Arms and cancels deadlines on the wheel and as one ring timeout each. The cost per timer of both is
+//     recorded as test properties for comparison, timings are not asserted on as they depend on the machine
+TEST(kls_io, TimerWheelThroughput) {
+    using namespace kls::io;
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+    using Clock = std::chrono::steady_clock;
+    static constexpr int count = 100000;
+
+    const auto per_timer = [](Clock::duration duration) {
+        return std::chrono::duration<double, std::nano>(duration).count() / count;
+    };
+
+    TimerWheel wheel{};
+    std::vector<CountingEntry> entries(count);
+    const auto wheel_start = Clock::now();
+    for (int i = 0; i < count; ++i) wheel.arm(entries[i], std::chrono::seconds(1 + i % 600));
+    for (auto &entry: entries) wheel.cancel(entry);
+    const auto wheel_time = Clock::now() - wheel_start;
+
+    Clock::duration ring_time{};
+    run_blocking([&]() -> ValueAsync<void> {
+        std::vector<std::unique_ptr<SleepAwait>> sleeps{};
+        sleeps.reserve(count);
+        const auto ring_start = Clock::now();
+        for (int i = 0; i < count; ++i) sleeps.emplace_back(new SleepAwait(sleep_for(std::chrono::seconds(1 + i % 600))));
+        for (auto &sleep: sleeps) detail::cancel(sleep.get());
+        for (auto &sleep: sleeps) {
+            const auto status = co_await *sleep;
+            EXPECT_EQ(status, IO_ECANCELED);
+        }
+        ring_time = Clock::now() - ring_start;
+    });
+
+    RecordProperty("wheel_ns_per_timer", static_cast<int>(per_timer(wheel_time)));
+    RecordProperty("ring_timeout_ns_per_timer", static_cast<int>(per_timer(ring_time)));
+}
+#endif